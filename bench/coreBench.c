@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "shopCore.h"
+#include "orderLog.h"
+#include "kitchenKernel.h"
+#include "shopWorkers.h"
+
+//microbenchmarks of the building blocks of the shop in isolation: each one runs with 1, 2, 4, ... threads and
+//reports ns per operation, total throughput and, where perf_event_open is allowed, instructions and L1 data cache
+//read misses.
+
+#define DEFAULT_MAX_THREADS 4
+#define DEFAULT_MIN_MS 200 //every measurement runs at least this long
+#define BENCH_ORDERS 4096 //order slots and queue capacity
+#define MAX_BENCH_THREADS 256
+#define L1D_READ_MISS (PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+//one building block, run(thread, iterations) performs iterations operations on behalf of a thread
+typedef struct {
+    const char *name;
+    void (*run)(int thread, long iterations);
+} CoreBench;
+
+//hardware counters read around every measurement, -1 when the kernel does not allow them
+typedef struct {
+    int instructions;
+    int l1d_misses; //L1 data cache read misses, a counter line stolen by another core misses here
+} PerfCounters;
+
+//Cook as PideShop laid it out before every worker got its own cache lines, the baseline of the padded Cook
+typedef struct {
+    pthread_t thread;
+    int id;
+    Order *order;
+    int prepared_orders;
+    MetricsWorker *metrics;
+} PackedCook;
+
+static Order *thread_orders[MAX_BENCH_THREADS]; //order owned by every benchmark thread
+static PackedCook packed_cooks[MAX_BENCH_THREADS];
+static Cook padded_cooks[MAX_BENCH_THREADS];
+static pthread_barrier_t start_barrier;
+static volatile long sink; //keeps results alive
+
+static void bench_queue(int thread, long iterations) {
+    Order *order = thread_orders[thread];
+    for (long i = 0; i < iterations; i++) {
+        enqueue_preparation(order);
+        while (dequeue_preparation() == NULL) sched_yield(); //an item being pushed by another thread is not visible yet
+    }
+}
+
+static void bench_log(int thread, long iterations) {
+    Order *order = thread_orders[thread];
+    for (long i = 0; i < iterations; i++) log_order_status(order, (int)(i % 6), thread);
+}
+
+static void bench_delivery_time(int thread, long iterations) {
+    long total = 0;
+    for (long i = 0; i < iterations; i++) total += calculate_delivery_time((int)(i & 255), (int)((i >> 8) & 255), 1 + thread);
+    sink += total;
+}
+
+static void bench_prep(int thread, long iterations) {
+    (void)thread;
+    for (long i = 0; i < iterations; i++) simulate_computation_delay_prep();
+}
+
+static void bench_cook(int thread, long iterations) {
+    (void)thread;
+    for (long i = 0; i < iterations; i++) simulate_computation_delay_cook();
+}
+
+//every thread counts its own orders like cook_routine, the counter is stored on every iteration
+static void bench_packed_cooks(int thread, long iterations) {
+    volatile int *prepared = &packed_cooks[thread].prepared_orders;
+    for (long i = 0; i < iterations; i++) (*prepared)++;
+}
+
+static void bench_padded_cooks(int thread, long iterations) {
+    volatile int *prepared = &padded_cooks[thread].prepared_orders;
+    for (long i = 0; i < iterations; i++) (*prepared)++;
+}
+
+static const CoreBench benches[] = {
+    {"stage queue push+pop", bench_queue},
+    {"log_order_status", bench_log},
+    {"calculate_delivery_time", bench_delivery_time},
+    {"simulate_delay_prep", bench_prep},
+    {"simulate_delay_cook", bench_cook},
+    {"cook counters packed", bench_packed_cooks},
+    {"cook counters padded", bench_padded_cooks},
+};
+
+typedef struct {
+    const CoreBench *bench;
+    int thread;
+    long iterations;
+} BenchThread;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//user space counter of this process and the threads it creates afterwards
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long perf_read(int fd) {
+    long long value;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+}
+
+static void *bench_thread(void *arg) {
+    BenchThread *bench_thread = (BenchThread *)arg;
+    pthread_barrier_wait(&start_barrier);
+    bench_thread->bench->run(bench_thread->thread, bench_thread->iterations);
+    return NULL;
+}
+
+//run a benchmark on threads threads doing iterations operations each, returns the elapsed seconds
+static double measure(const CoreBench *bench, int threads, long iterations, long long *instructions, long long *l1d_misses) {
+    PerfCounters counters = {perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS), perf_open(PERF_TYPE_HW_CACHE, L1D_READ_MISS)};
+    pthread_t thread_ids[threads];
+    BenchThread args[threads];
+
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    if (counters.instructions >= 0) ioctl(counters.instructions, PERF_EVENT_IOC_ENABLE, 0);
+    if (counters.l1d_misses >= 0) ioctl(counters.l1d_misses, PERF_EVENT_IOC_ENABLE, 0);
+    for (int i = 0; i < threads; i++) {
+        args[i] = (BenchThread){bench, i, iterations};
+        pthread_create(&thread_ids[i], NULL, bench_thread, &args[i]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    double start = now_seconds();
+    for (int i = 0; i < threads; i++) pthread_join(thread_ids[i], NULL);
+    double elapsed = now_seconds() - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    //inherited counts of the exited threads are folded into the parent counters
+    *instructions = perf_read(counters.instructions);
+    *l1d_misses = perf_read(counters.l1d_misses);
+    if (counters.instructions >= 0) close(counters.instructions);
+    if (counters.l1d_misses >= 0) close(counters.l1d_misses);
+    return elapsed;
+}
+
+//iterations one thread needs to run for about min_ms
+static long calibrate(const CoreBench *bench, int min_ms) {
+    long long unused;
+    long iterations = 1;
+    while (1) {
+        double elapsed = measure(bench, 1, iterations, &unused, &unused);
+        if (elapsed * 1000 >= min_ms / 4.0 || iterations > (1L << 40)) return (long)(iterations * (min_ms / 1000.0) / elapsed) + 1;
+        iterations *= elapsed * 1000 < min_ms / 100.0 ? 10 : 2;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+    int min_ms = argc > 2 ? atoi(argv[2]) : DEFAULT_MIN_MS;
+    SchedPolicy policy = SCHEDULE_FIFO; //policy of the preparation queue measured by the stage queue benchmark
+    if (max_threads <= 0 || max_threads > MAX_BENCH_THREADS || min_ms <= 0 || (argc > 3 && sched_parse_policy(argv[3], &policy) < 0)) {
+        printf("Usage: %s [max_threads] [min_ms] [fifo|edf|stf]\n", argv[0]);
+        return 1;
+    }
+
+    if (shop_core_init(BENCH_ORDERS, BENCH_ORDERS, policy) < 0 || order_log_open("/dev/null", DEFAULT_LOG_FLUSH_MS) < 0 || kernel_select(KERNEL_AUTO) < 0) {
+        printf("Failed to set up the shop core\n");
+        return 1;
+    }
+    for (int i = 0; i < max_threads; i++) {
+        SlabHandle handle;
+        thread_orders[i] = slab_alloc(&order_slab, &handle);
+        thread_orders[i]->handle = handle;
+        thread_orders[i]->order_id = i + 1;
+        thread_orders[i]->sched_key = i;
+    }
+    printf("Using %s kitchen kernel, %s stage queue, at least %d ms per measurement\n", kernel_name(), sched_policy_name(policy), min_ms);
+
+    int probe_fd = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    if (probe_fd < 0) {
+        printf("perf_event_open is not available, instruction and L1D miss counts are skipped\n");
+    } else {
+        close(probe_fd);
+    }
+
+    printf("%-24s %8s %12s %14s %12s %14s\n", "benchmark", "threads", "ns/op", "ops/s", "instr/op", "L1D-miss/op");
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        long iterations = calibrate(&benches[b], min_ms);
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            long long instructions, l1d_misses;
+            double elapsed = measure(&benches[b], threads, iterations, &instructions, &l1d_misses);
+            double operations = (double)iterations * threads;
+            printf("%-24s %8d %12.1f %14.0f", benches[b].name, threads, elapsed * 1e9 / iterations, operations / elapsed);
+            if (instructions >= 0) printf(" %12.1f", instructions / operations); else printf(" %12s", "n/a");
+            if (l1d_misses >= 0) printf(" %14.3f\n", l1d_misses / operations); else printf(" %14s\n", "n/a");
+        }
+    }
+
+    order_log_close();
+    return 0;
+}
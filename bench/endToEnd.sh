@@ -0,0 +1,91 @@
+#!/bin/bash
+#end-to-end benchmark: drives PideShop with HungryVeryMuch over a matrix of pool sizes and client counts,
+#writes orders/s and per-stage latency percentiles to a CSV file and compares them against a saved baseline.
+#every setting is an environment variable so `make bench BENCH_CLIENTS="1000 5000"` works.
+
+COOKS=${BENCH_COOKS:-"2 4"} #cook_pool_size values
+COURIERS=${BENCH_COURIERS:-"2 4"} #delivery_pool_size values
+CLIENTS=${BENCH_CLIENTS:-"500 2000"} #orders per run
+SPEED=${BENCH_SPEED:-50} #delivery_speed
+TOWN=${BENCH_TOWN:-20} #town is TOWN x TOWN
+THREADS=${BENCH_THREADS:-2} #generator threads of HungryVeryMuch
+CLIENT_ARGS=${BENCH_CLIENT_ARGS:-""} #extra HungryVeryMuch options, e.g. --multiplex 4
+SHOP_ARGS=${BENCH_SHOP_ARGS:-""} #extra PideShop options
+PORT=${BENCH_PORT:-9400}
+RESULTS=${BENCH_RESULTS:-bench/results.csv}
+BASELINE=${BENCH_BASELINE:-bench/baseline.csv}
+THRESHOLD=${BENCH_THRESHOLD:-10} #percent slower than the baseline that counts as a regression
+TIMEOUT=${BENCH_TIMEOUT:-300} #seconds one run may take
+
+ROOT=$(pwd)
+HEADER="cooks,couriers,clients,stage,orders,orders_per_s,mean_ms,p50_ms,p99_ms,p999_ms,max_ms"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+echo "$HEADER" > "$RESULTS"
+for cooks in $COOKS; do
+    for couriers in $COURIERS; do
+        for clients in $CLIENTS; do
+            (cd "$WORK" && exec "$ROOT/PideShop" 127.0.0.1 "$PORT" "$cooks" "$couriers" "$SPEED" $SHOP_ARGS > shop.out 2>&1) &
+            shop=$!
+            #wait until the shop listens
+            tries=0
+            while ! (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && [ $tries -lt 50 ]; do
+                sleep 0.1
+                tries=$((tries + 1))
+            done
+
+            rm -f "$WORK/run.csv"
+            timeout "$TIMEOUT" "$ROOT/HungryVeryMuch" 127.0.0.1 "$PORT" "$clients" "$TOWN" "$TOWN" --threads "$THREADS" --quiet \
+                --results "$WORK/run.csv" $CLIENT_ARGS > "$WORK/client.out" 2>&1
+            status=$?
+            kill -INT $shop 2>/dev/null
+            wait $shop 2>/dev/null
+
+            if [ $status -ne 0 ] || [ ! -s "$WORK/run.csv" ]; then
+                echo "cooks=$cooks couriers=$couriers clients=$clients: run failed"
+                tail -3 "$WORK/client.out"
+                exit 1
+            fi
+            sed "s/^/$cooks,$couriers,$clients,/" "$WORK/run.csv" >> "$RESULTS"
+            awk -F, -v c="$cooks" -v d="$couriers" -v n="$clients" '$1 == 5 {
+                printf "cooks=%s couriers=%s clients=%s: %s orders/s, delivered p50 %s ms, p99 %s ms, p99.9 %s ms\n", c, d, n, $3, $5, $6, $7
+            }' "$WORK/run.csv"
+        done
+    done
+done
+echo "Results written to $RESULTS"
+
+if [ -n "$BENCH_SAVE_BASELINE" ]; then
+    cp "$RESULTS" "$BASELINE"
+    echo "Saved as the baseline in $BASELINE"
+    exit 0
+fi
+if [ ! -f "$BASELINE" ]; then
+    echo "No baseline in $BASELINE, run make bench-baseline to save one"
+    exit 0
+fi
+
+#flag runs whose throughput dropped or whose p50/p99 latency grew by more than THRESHOLD percent
+awk -F, -v threshold="$THRESHOLD" '
+    FNR == 1 { next }
+    NR == FNR { key = $1 "," $2 "," $3 "," $4; rate[key] = $6; p50[key] = $8; p99[key] = $9; next }
+    {
+        key = $1 "," $2 "," $3 "," $4
+        if (!(key in rate)) next
+        name = "cooks=" $1 " couriers=" $2 " clients=" $3 " stage=" $4
+        if ($4 == 5 && $6 < rate[key] * (1 - threshold / 100)) {
+            printf "REGRESSION %s: %.1f orders/s, baseline %.1f\n", name, $6, rate[key]; regressions++
+        }
+        if ($8 > p50[key] * (1 + threshold / 100) && $8 - p50[key] > 1) {
+            printf "REGRESSION %s: p50 %.3f ms, baseline %.3f ms\n", name, $8, p50[key]; regressions++
+        }
+        if ($9 > p99[key] * (1 + threshold / 100) && $9 - p99[key] > 1) {
+            printf "REGRESSION %s: p99 %.3f ms, baseline %.3f ms\n", name, $9, p99[key]; regressions++
+        }
+        compared++
+    }
+    END {
+        printf "Compared %d rows against the baseline, %d regressions over %s%%\n", compared, regressions, threshold
+        exit regressions > 0
+    }' "$BASELINE" "$RESULTS"
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stageQueue.h"
+
+//contention benchmark for the stage queues: one manager feeds N cooks, the cooks feed one courier.
+//the "mutex" mode reproduces the old layout where every queue operation takes one global lock.
+
+#define BENCH_QUEUE_SIZE 4096
+#define DEFAULT_ORDERS 200000
+#define DEFAULT_MAX_COOKS 32
+#define COOK_WORK 200 //iterations of dummy work per order, stands in for the real kernel
+
+//ring protected by the shared global mutex
+typedef struct {
+    void *items[BENCH_QUEUE_SIZE];
+    int start, end;
+} LockedRing;
+
+static pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prep_cond = PTHREAD_COND_INITIALIZER;
+static LockedRing locked_prep, locked_delivery;
+static StageQueue prep_queue, delivery_queue;
+static int use_mutex;
+static long orders_per_run;
+static char stop_marker; //address pushed once per cook to stop it
+
+static int ring_push(LockedRing *ring, void *item) {
+    int next = (ring->end + 1) % BENCH_QUEUE_SIZE;
+    if (next == ring->start) return -1;
+    ring->items[ring->end] = item;
+    ring->end = next;
+    return 0;
+}
+
+static void *ring_pop(LockedRing *ring) {
+    if (ring->start == ring->end) return NULL;
+    void *item = ring->items[ring->start];
+    ring->start = (ring->start + 1) % BENCH_QUEUE_SIZE;
+    return item;
+}
+
+static void push_prep(void *item) {
+    if (use_mutex) {
+        while (1) {
+            pthread_mutex_lock(&global_mutex);
+            int result = ring_push(&locked_prep, item);
+            if (result == 0) pthread_cond_signal(&prep_cond);
+            pthread_mutex_unlock(&global_mutex);
+            if (result == 0) return;
+            sched_yield();
+        }
+    }
+    while (stage_queue_push(&prep_queue, item) < 0) sched_yield();
+}
+
+static void *pop_prep(void) {
+    if (use_mutex) {
+        pthread_mutex_lock(&global_mutex);
+        void *item;
+        while ((item = ring_pop(&locked_prep)) == NULL) pthread_cond_wait(&prep_cond, &global_mutex);
+        pthread_mutex_unlock(&global_mutex);
+        return item;
+    }
+    return stage_queue_pop_wait(&prep_queue);
+}
+
+static void push_delivery(void *item) {
+    while (1) {
+        int result;
+        if (use_mutex) {
+            pthread_mutex_lock(&global_mutex);
+            result = ring_push(&locked_delivery, item);
+            pthread_mutex_unlock(&global_mutex);
+        } else {
+            result = stage_queue_push(&delivery_queue, item);
+        }
+        if (result == 0) return;
+        sched_yield();
+    }
+}
+
+static void *pop_delivery(void) {
+    if (use_mutex) {
+        pthread_mutex_lock(&global_mutex);
+        void *item = ring_pop(&locked_delivery);
+        pthread_mutex_unlock(&global_mutex);
+        return item;
+    }
+    return stage_queue_pop(&delivery_queue);
+}
+
+static void *cook_thread(void *arg) {
+    (void)arg;
+    volatile double sink = 0;
+    while (1) {
+        void *item = pop_prep();
+        if (item == &stop_marker) return NULL;
+        for (int i = 0; i < COOK_WORK; i++) sink += i * 0.5;
+        push_delivery(item);
+    }
+}
+
+static void *courier_thread(void *arg) {
+    (void)arg;
+    long delivered = 0;
+    while (delivered < orders_per_run) {
+        if (pop_delivery() != NULL) {
+            delivered++;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//push orders through the pipeline with the given number of cooks, returns orders per second
+static double run(int cooks) {
+    pthread_t cook_threads[cooks];
+    pthread_t courier;
+
+    double start = now_seconds();
+    pthread_create(&courier, NULL, courier_thread, NULL);
+    for (int i = 0; i < cooks; i++) pthread_create(&cook_threads[i], NULL, cook_thread, NULL);
+
+    for (long i = 0; i < orders_per_run; i++) push_prep((void *)(i + 1));
+    pthread_join(courier, NULL);
+    double elapsed = now_seconds() - start;
+
+    for (int i = 0; i < cooks; i++) push_prep(&stop_marker);
+    for (int i = 0; i < cooks; i++) pthread_join(cook_threads[i], NULL);
+    return orders_per_run / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    int max_cooks = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_COOKS;
+    orders_per_run = argc > 2 ? atol(argv[2]) : DEFAULT_ORDERS;
+    if (max_cooks <= 0 || orders_per_run <= 0) {
+        printf("Usage: %s [max_cooks] [orders_per_run]\n", argv[0]);
+        return 1;
+    }
+
+    if (stage_queue_init(&prep_queue, BENCH_QUEUE_SIZE) < 0 || stage_queue_init(&delivery_queue, BENCH_QUEUE_SIZE) < 0) {
+        printf("Failed to allocate queues\n");
+        return 1;
+    }
+
+    printf("%8s %18s %18s %8s\n", "cooks", "mutex orders/s", "lockfree orders/s", "speedup");
+    for (int cooks = 1; cooks <= max_cooks; cooks *= 2) {
+        use_mutex = 1;
+        double locked = run(cooks);
+        use_mutex = 0;
+        double lock_free = run(cooks);
+        printf("%8d %18.0f %18.0f %7.2fx\n", cooks, locked, lock_free, lock_free / locked);
+    }
+
+    stage_queue_destroy(&prep_queue);
+    stage_queue_destroy(&delivery_queue);
+    return 0;
+}
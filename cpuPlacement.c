@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpuPlacement.h"
+
+#ifndef SYSFS_CPU_DIR
+#define SYSFS_CPU_DIR "/sys/devices/system/cpu"
+#endif
+
+static int core_of[CPU_SETSIZE]; //physical core of every online CPU, numbered from 0
+static int core_count = 0;
+
+//read a small sysfs file, returns -1 if it does not exist
+static int read_sysfs(const char *path, char *buffer, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    size_t length = fread(buffer, 1, size - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+    return 0;
+}
+
+//parse a kernel CPU list such as "0-3,8,10-11"
+int cpu_parse_list(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) return -1;
+        }
+        if (last >= CPU_SETSIZE) return -1;
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, set);
+        p = end;
+        if (*p == ',') p++;
+        else if (*p != '\0' && *p != '\n') return -1;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+//write a CPU set in the kernel list format
+void cpu_format_list(const cpu_set_t *set, char *buffer, size_t size) {
+    size_t used = 0;
+    buffer[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && used < size; cpu++) {
+        if (!CPU_ISSET(cpu, set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+        if (last == cpu) {
+            used += snprintf(buffer + used, size - used, used ? ",%d" : "%d", cpu);
+        } else {
+            used += snprintf(buffer + used, size - used, used ? ",%d-%d" : "%d-%d", cpu, last);
+        }
+        cpu = last;
+    }
+}
+
+//CPUs the kernel has online
+int cpu_online(cpu_set_t *set) {
+    char buffer[1024];
+    if (read_sysfs(SYSFS_CPU_DIR "/online", buffer, sizeof(buffer)) < 0) return -1;
+    return cpu_parse_list(buffer, set);
+}
+
+//number the physical cores from the package and core ids in sysfs, a CPU without topology is its own core
+int cpu_topology_load(void) {
+    cpu_set_t online;
+    int packages[CPU_SETSIZE], cores[CPU_SETSIZE];
+    if (cpu_online(&online) < 0) return -1;
+
+    core_count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &online)) continue;
+        char path[128], buffer[32];
+        int package = -1, core = -1;
+        snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/topology/physical_package_id", cpu);
+        if (read_sysfs(path, buffer, sizeof(buffer)) == 0) package = atoi(buffer);
+        snprintf(path, sizeof(path), SYSFS_CPU_DIR "/cpu%d/topology/core_id", cpu);
+        if (read_sysfs(path, buffer, sizeof(buffer)) == 0) core = atoi(buffer);
+
+        core_of[cpu] = -1;
+        for (int other = 0; other < cpu && core >= 0; other++) {
+            if (CPU_ISSET(other, &online) && packages[other] == package && cores[other] == core) core_of[cpu] = core_of[other];
+        }
+        if (core_of[cpu] < 0) core_of[cpu] = core_count++;
+        packages[cpu] = package;
+        cores[cpu] = core;
+    }
+    return 0;
+}
+
+int cpu_parse_policy(const char *name, PlacementPolicy *policy) {
+    if (strcmp(name, "shared") == 0) {
+        *policy = PLACEMENT_SHARED;
+    } else if (strcmp(name, "per-core") == 0) {
+        *policy = PLACEMENT_PER_CORE;
+    } else if (strcmp(name, "no-smt") == 0) {
+        *policy = PLACEMENT_NO_SMT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *cpu_policy_name(PlacementPolicy policy) {
+    switch (policy) {
+        case PLACEMENT_PER_CORE:
+            return "one thread per physical core";
+        case PLACEMENT_NO_SMT:
+            return "one thread per core, SMT siblings idle";
+        default:
+            return "shared";
+    }
+}
+
+//split the CPUs of a pool into slots by policy, cpu_topology_load must have been called
+int cpu_pool_init(CpuPool *pool, const char *name, const cpu_set_t *cpus, PlacementPolicy policy) {
+    pool->name = name;
+    pool->cpus = *cpus;
+    pool->slot_count = 0;
+    pool->slots = malloc(MAX_PLACEMENT_SLOTS * sizeof(cpu_set_t));
+    if (pool->slots == NULL) return -1;
+
+    if (policy == PLACEMENT_SHARED) {
+        pool->slots[pool->slot_count++] = *cpus;
+        return 0;
+    }
+
+    //one slot per physical core in the order of its first CPU
+    int slot_of_core[CPU_SETSIZE];
+    for (int core = 0; core < core_count; core++) slot_of_core[core] = -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpus)) continue;
+        int core = core_of[cpu];
+        if (slot_of_core[core] < 0) {
+            slot_of_core[core] = pool->slot_count++;
+            CPU_ZERO(&pool->slots[slot_of_core[core]]);
+        } else if (policy == PLACEMENT_NO_SMT) {
+            continue; //a sibling of a CPU already in a slot
+        }
+        CPU_SET(cpu, &pool->slots[slot_of_core[core]]);
+    }
+    return pool->slot_count > 0 ? 0 : -1;
+}
+
+//pin the index-th thread of a pool to its slot
+int cpu_pool_pin(CpuPool *pool, pthread_t thread, int index) {
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &pool->slots[index % pool->slot_count]) == 0 ? 0 : -1;
+}
+
+//print where the threads of a pool run
+void cpu_pool_print(CpuPool *pool, int threads) {
+    char list[256];
+    cpu_format_list(&pool->cpus, list, sizeof(list));
+    printf("Placing %d %s threads on CPUs %s", threads, pool->name, list);
+    if (pool->slot_count > 1 || CPU_COUNT(&pool->slots[0]) != CPU_COUNT(&pool->cpus)) {
+        printf(", round robin over");
+        for (int i = 0; i < pool->slot_count && i < threads; i++) {
+            cpu_format_list(&pool->slots[i], list, sizeof(list));
+            printf(" {%s}", list);
+        }
+    }
+    printf("\n");
+}
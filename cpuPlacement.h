@@ -0,0 +1,34 @@
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#include <sched.h>
+#include <pthread.h>
+
+#define MAX_PLACEMENT_SLOTS CPU_SETSIZE
+
+//how the threads of a pool are spread over its CPUs
+typedef enum {
+    PLACEMENT_SHARED, //every thread may run on any CPU of the pool
+    PLACEMENT_PER_CORE, //threads go round robin over the physical cores, each one may use the SMT siblings of its core
+    PLACEMENT_NO_SMT //threads go round robin over one hardware thread per core, the siblings stay idle
+} PlacementPolicy;
+
+//CPUs of a pool split into the slots its threads are pinned to
+typedef struct {
+    const char *name;
+    cpu_set_t cpus; //every CPU the pool may use
+    cpu_set_t *slots; //CPUs of each slot
+    int slot_count;
+} CpuPool;
+
+int cpu_topology_load(void);
+int cpu_online(cpu_set_t *set);
+int cpu_parse_list(const char *list, cpu_set_t *set);
+void cpu_format_list(const cpu_set_t *set, char *buffer, size_t size);
+int cpu_parse_policy(const char *name, PlacementPolicy *policy);
+const char *cpu_policy_name(PlacementPolicy policy);
+int cpu_pool_init(CpuPool *pool, const char *name, const cpu_set_t *cpus, PlacementPolicy policy);
+int cpu_pool_pin(CpuPool *pool, pthread_t thread, int index);
+void cpu_pool_print(CpuPool *pool, int threads);
+
+#endif
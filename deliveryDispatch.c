@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "deliveryDispatch.h"
+
+#define ENTRY_CHUNK 256 //entries allocated at once when the free list runs out
+
+//floor division so negative coordinates get their own cells
+static int cell_of(int value, int cell_size) {
+    return value >= 0 ? value / cell_size : -((-value + cell_size - 1) / cell_size);
+}
+
+static unsigned bucket_of(int cell_x, int cell_y) {
+    unsigned hash = (unsigned)cell_x * 73856093u ^ (unsigned)cell_y * 19349663u;
+    return hash & (DISPATCH_BUCKETS - 1);
+}
+
+static double distance(int x1, int y1, int x2, int y2) {
+    double dx = x1 - x2, dy = y1 - y2;
+    return sqrt(dx * dx + dy * dy);
+}
+
+//initialize an empty grid
+void dispatch_init(DispatchGrid *grid, int cell_size) {
+    for (int i = 0; i < DISPATCH_BUCKETS; i++) grid->buckets[i] = NULL;
+    grid->oldest = grid->newest = NULL;
+    grid->free_entries = NULL;
+    grid->cell_size = cell_size > 0 ? cell_size : DEFAULT_GRID_CELL;
+    grid->count = 0;
+}
+
+//add a ready order, returns -1 if no memory is left
+int dispatch_insert(DispatchGrid *grid, void *item, int x, int y) {
+    if (grid->free_entries == NULL) {
+        GridEntry *chunk = malloc(ENTRY_CHUNK * sizeof(GridEntry));
+        if (chunk == NULL) return -1;
+        for (int i = 0; i < ENTRY_CHUNK; i++) {
+            chunk[i].cell_next = grid->free_entries;
+            grid->free_entries = &chunk[i];
+        }
+    }
+    GridEntry *entry = grid->free_entries;
+    grid->free_entries = entry->cell_next;
+
+    entry->item = item;
+    entry->x = x;
+    entry->y = y;
+    entry->cell_x = cell_of(x, grid->cell_size);
+    entry->cell_y = cell_of(y, grid->cell_size);
+
+    entry->age_prev = grid->newest;
+    entry->age_next = NULL;
+    if (grid->newest != NULL) grid->newest->age_next = entry;
+    else grid->oldest = entry;
+    grid->newest = entry;
+
+    GridEntry **bucket = &grid->buckets[bucket_of(entry->cell_x, entry->cell_y)];
+    entry->cell_prev = NULL;
+    entry->cell_next = *bucket;
+    if (*bucket != NULL) (*bucket)->cell_prev = entry;
+    *bucket = entry;
+
+    grid->count++;
+    return 0;
+}
+
+//unlink an entry from both lists and put it on the free list
+static void remove_entry(DispatchGrid *grid, GridEntry *entry) {
+    if (entry->age_prev != NULL) entry->age_prev->age_next = entry->age_next;
+    else grid->oldest = entry->age_next;
+    if (entry->age_next != NULL) entry->age_next->age_prev = entry->age_prev;
+    else grid->newest = entry->age_prev;
+
+    if (entry->cell_prev != NULL) entry->cell_prev->cell_next = entry->cell_next;
+    else grid->buckets[bucket_of(entry->cell_x, entry->cell_y)] = entry->cell_next;
+    if (entry->cell_next != NULL) entry->cell_next->cell_prev = entry->cell_prev;
+
+    entry->cell_next = grid->free_entries;
+    grid->free_entries = entry;
+    grid->count--;
+}
+
+//keep the best candidates sorted by distance, returns the new number of candidates
+static int add_candidate(GridEntry **best, double *best_distance, int found, int wanted, GridEntry *entry, double d) {
+    if (found == wanted && d >= best_distance[found - 1]) return found;
+    int i = found < wanted ? found++ : found - 1;
+    while (i > 0 && best_distance[i - 1] > d) {
+        best[i] = best[i - 1];
+        best_distance[i] = best_distance[i - 1];
+        i--;
+    }
+    best[i] = entry;
+    best_distance[i] = d;
+    return found;
+}
+
+//take the oldest ready order plus up to max_items - 1 orders nearest to it,
+//radius <= 0 means any distance; returns the number of items taken
+int dispatch_take_batch(DispatchGrid *grid, void **items, int max_items, double radius) {
+    if (grid->oldest == NULL || max_items <= 0) return 0;
+
+    GridEntry *anchor = grid->oldest;
+    int wanted = max_items - 1 < MAX_ROUTE_STOPS ? max_items - 1 : MAX_ROUTE_STOPS;
+    GridEntry *best[MAX_ROUTE_STOPS];
+    double best_distance[MAX_ROUTE_STOPS];
+    int found = 0;
+    size_t seen = 1; //the anchor itself
+
+    //scan rings of cells around the anchor until the rest of the ring cannot hold anything closer
+    size_t cells_scanned = 0;
+    for (int ring = 0; wanted > 0 && seen < grid->count; ring++) {
+        double ring_distance = (double)(ring - 1) * grid->cell_size; //closest a point in this ring can be
+        if (radius > 0 && ring_distance > radius) break;
+        if (found == wanted && ring_distance > best_distance[found - 1]) break;
+
+        //sparse orders far apart would need huge rings, comparing against every entry is cheaper then
+        cells_scanned += ring == 0 ? 1 : 8 * ring;
+        if (cells_scanned > 4 * grid->count + 64) {
+            found = 0;
+            for (GridEntry *entry = anchor->age_next; entry != NULL; entry = entry->age_next) {
+                double d = distance(anchor->x, anchor->y, entry->x, entry->y);
+                if (radius > 0 && d > radius) continue;
+                found = add_candidate(best, best_distance, found, wanted, entry, d);
+            }
+            break;
+        }
+
+        for (int dx = -ring; dx <= ring; dx++) {
+            for (int dy = -ring; dy <= ring; dy++) {
+                if (abs(dx) != ring && abs(dy) != ring) continue; //inner cells were scanned already
+                int cell_x = anchor->cell_x + dx, cell_y = anchor->cell_y + dy;
+                for (GridEntry *entry = grid->buckets[bucket_of(cell_x, cell_y)]; entry != NULL; entry = entry->cell_next) {
+                    if (entry == anchor || entry->cell_x != cell_x || entry->cell_y != cell_y) continue;
+                    seen++;
+                    double d = distance(anchor->x, anchor->y, entry->x, entry->y);
+                    if (radius > 0 && d > radius) continue;
+                    found = add_candidate(best, best_distance, found, wanted, entry, d);
+                }
+            }
+        }
+    }
+
+    items[0] = anchor->item;
+    remove_entry(grid, anchor);
+    for (int i = 0; i < found; i++) {
+        items[i + 1] = best[i]->item;
+        remove_entry(grid, best[i]);
+    }
+    return found + 1;
+}
+
+//number of ready orders in the grid
+size_t dispatch_count(DispatchGrid *grid) {
+    return grid->count;
+}
+
+//oldest ready order, or NULL if the grid is empty
+void *dispatch_oldest(DispatchGrid *grid) {
+    return grid->oldest != NULL ? grid->oldest->item : NULL;
+}
+
+//length of the tour shop -> stops in route order -> shop
+static double tour_length(int count, const int *xs, const int *ys, const int *route) {
+    double length = 0;
+    int x = 0, y = 0; //the shop is at the origin
+    for (int i = 0; i < count; i++) {
+        length += distance(x, y, xs[route[i]], ys[route[i]]);
+        x = xs[route[i]];
+        y = ys[route[i]];
+    }
+    return length + distance(x, y, 0, 0);
+}
+
+//order the stops with nearest neighbor from the shop, then improve with 2-opt;
+//route receives indices into xs/ys, returns the length of the round trip
+double plan_route(int count, const int *xs, const int *ys, int *route) {
+    int used[MAX_ROUTE_STOPS] = {0};
+    int x = 0, y = 0;
+    if (count > MAX_ROUTE_STOPS) count = MAX_ROUTE_STOPS;
+
+    for (int i = 0; i < count; i++) {
+        int next = -1;
+        double next_distance = 0;
+        for (int j = 0; j < count; j++) {
+            if (used[j]) continue;
+            double d = distance(x, y, xs[j], ys[j]);
+            if (next < 0 || d < next_distance) {
+                next = j;
+                next_distance = d;
+            }
+        }
+        used[next] = 1;
+        route[i] = next;
+        x = xs[next];
+        y = ys[next];
+    }
+
+    //reverse route[i..j] while that shortens the tour
+    double length = tour_length(count, xs, ys, route);
+    int improved = 1;
+    while (improved) {
+        improved = 0;
+        for (int i = 0; i < count - 1; i++) {
+            for (int j = i + 1; j < count; j++) {
+                for (int a = i, b = j; a < b; a++, b--) {
+                    int swap = route[a];
+                    route[a] = route[b];
+                    route[b] = swap;
+                }
+                double candidate = tour_length(count, xs, ys, route);
+                if (candidate + 1e-9 < length) {
+                    length = candidate;
+                    improved = 1;
+                } else {
+                    for (int a = i, b = j; a < b; a++, b--) {
+                        int swap = route[a];
+                        route[a] = route[b];
+                        route[b] = swap;
+                    }
+                }
+            }
+        }
+    }
+    return length;
+}
@@ -0,0 +1,35 @@
+#ifndef DELIVERY_DISPATCH_H
+#define DELIVERY_DISPATCH_H
+
+#include <stddef.h>
+
+#define DISPATCH_BUCKETS 1024 //hash buckets of the grid, power of two
+#define DEFAULT_GRID_CELL 8 //side of a grid cell in town units
+#define MAX_ROUTE_STOPS 16 //largest bag the route planner handles
+
+//ready order stored in the grid, linked by age and by cell
+typedef struct GridEntry {
+    void *item;
+    int x, y; //delivery address
+    int cell_x, cell_y; //grid cell of the address
+    struct GridEntry *age_prev, *age_next; //all entries, oldest first
+    struct GridEntry *cell_prev, *cell_next; //entries of the same hash bucket
+} GridEntry;
+
+//uniform grid over ready orders, hashed so the town size does not need to be known
+typedef struct {
+    GridEntry *buckets[DISPATCH_BUCKETS];
+    GridEntry *oldest, *newest; //age list, the oldest order anchors every batch
+    GridEntry *free_entries; //recycled entries
+    int cell_size;
+    size_t count; //entries currently in the grid
+} DispatchGrid;
+
+void dispatch_init(DispatchGrid *grid, int cell_size);
+int dispatch_insert(DispatchGrid *grid, void *item, int x, int y);
+int dispatch_take_batch(DispatchGrid *grid, void **items, int max_items, double radius);
+size_t dispatch_count(DispatchGrid *grid);
+void *dispatch_oldest(DispatchGrid *grid);
+double plan_route(int count, const int *xs, const int *ys, int *route);
+
+#endif
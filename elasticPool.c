@@ -0,0 +1,37 @@
+#define _GNU_SOURCE
+#include <limits.h>
+
+#include "elasticPool.h"
+
+//start with min workers active
+void elastic_pool_init(ElasticPool *pool, int min, int max) {
+    pool->min = min;
+    pool->max = max;
+    atomic_init(&pool->active, min);
+}
+
+//whether a worker should take more work
+bool elastic_pool_active(ElasticPool *pool, int id) {
+    return (uint32_t)id < atomic_load_explicit(&pool->active, memory_order_relaxed);
+}
+
+//sleep without using any CPU until the pool grows to include the worker
+void elastic_pool_park(ElasticPool *pool, int id) {
+    uint32_t active;
+    while ((uint32_t)id >= (active = atomic_load(&pool->active))) {
+        futex_wait(&pool->active, active);
+    }
+}
+
+//change the number of active workers within the bounds, parked workers that became active wake up. Returns the new size
+int elastic_pool_resize(ElasticPool *pool, int active) {
+    if (active < pool->min) active = pool->min;
+    if (active > pool->max) active = pool->max;
+    uint32_t previous = atomic_exchange(&pool->active, active);
+    if ((uint32_t)active > previous) futex_wake(&pool->active, INT_MAX);
+    return active;
+}
+
+int elastic_pool_size(ElasticPool *pool) {
+    return atomic_load(&pool->active);
+}
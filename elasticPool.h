@@ -0,0 +1,23 @@
+#ifndef ELASTIC_POOL_H
+#define ELASTIC_POOL_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "stageQueue.h"
+
+//pool of worker threads created at its largest size, of which only the first active ones take work.
+//The others sleep on a futex until the pool grows past them, a worker retires once it finishes what it holds
+typedef struct {
+    _Atomic uint32_t active; //workers with an id below this take work, also the futex word parked workers sleep on
+    int min, max; //bounds of active
+} ElasticPool;
+
+void elastic_pool_init(ElasticPool *pool, int min, int max);
+bool elastic_pool_active(ElasticPool *pool, int id);
+void elastic_pool_park(ElasticPool *pool, int id);
+int elastic_pool_resize(ElasticPool *pool, int active);
+int elastic_pool_size(ElasticPool *pool);
+
+#endif
@@ -2,196 +2,812 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 
-#define MAX_CLIENTS 1000
+#include "pideProtocol.h"
+#include "latencyHistogram.h"
 
-int client_sockets[MAX_CLIENTS]; //array to hold client socket descriptors
+#define MAX_ORDERS (1 << 20) //orders one run may place
+#define MAX_THREADS 64 //generator threads
+#define MAX_CONNECTIONS 4096 //framed connections with --multiplex
+#define MAX_GENERATOR_EVENTS 256 //events handled per epoll_wait call
+#define STATUS_COUNT 8 //statuses 0 received to 6 canceled and 7 busy
+#define STOP_CHECK_MS 100 //longest a generator thread sleeps before it looks at the stop flag
+#define DEFAULT_HOTSPOTS 4
 
-//handling shutdown signals (SIGINT, SIGQUIT)
+//when orders arrive
+typedef enum {
+    ARRIVAL_CLOSED, //every order at once, the old burst of clients
+    ARRIVAL_CONSTANT, //evenly spaced at --rate orders per second
+    ARRIVAL_POISSON, //exponential gaps averaging --rate orders per second
+    ARRIVAL_BURST //--burst-size orders every --burst-interval-ms
+} ArrivalMode;
+
+//where orders are delivered
+typedef enum {
+    SPATIAL_UNIFORM, //anywhere in the town
+    SPATIAL_CENTER, //normal around the middle of the town
+    SPATIAL_HOTSPOTS //normal around a few random neighborhoods
+} SpatialMode;
+
+//order of a legacy client, one connection per order
+typedef struct LegacyOrder {
+    int socket;
+    int client; //client number, the order number starting at 1
+    int x, y; //coordinates of the delivery address
+    bool connected; //the handshake was sent, statuses are being read
+    unsigned char buffer[sizeof(int)]; //partially received status
+    size_t received;
+    struct LegacyOrder *prev, *next; //orders in progress of the thread
+} LegacyOrder;
+
+//orders sent over one multiplexed connection
+typedef struct {
+    int socket;
+    int *clients; //client numbers of the orders sent on this connection, in the order they were sent
+    int order_count; //orders sent on this connection
+    int accepted; //orders the shop answered with an order id
+    int finished; //orders delivered or canceled
+    OrderRequest pending[MAX_FRAME_ORDERS]; //orders waiting for the next frame
+    int pending_clients[MAX_FRAME_ORDERS];
+    int pending_count;
+    unsigned char buffer[sizeof(StatusFrame)]; //partially received status frame
+    size_t received;
+    unsigned char *output; //frames the shop has not taken yet, the socket is non-blocking so a paused shop never stalls the thread
+    size_t output_capacity, output_length, output_sent;
+    bool waiting_output; //EPOLLOUT is watched until the output is written
+} MuxConnection;
+
+//generator thread, places orders id, id + thread_count, ... and reads their statuses
+typedef struct {
+    pthread_t thread; //thread ID
+    int id; //generator ID
+    int epoll_fd;
+    int order_count; //orders this thread places
+    int placed; //orders placed so far
+    int finished; //orders delivered, canceled or failed
+    int failed; //orders that never reached the shop
+    unsigned int seed; //rand_r state for arrivals and addresses
+    uint64_t poisson_ns; //offset of the last Poisson arrival
+    LegacyOrder *live_orders; //legacy orders in progress, canceled on shutdown
+    MuxConnection **connections; //framed connections of this thread, multiplexed mode only
+    int connection_count;
+    int next_connection; //round robin over the connections
+    int *order_ids; //open addressing table of order ids
+    int *order_clients; //client number of the order id in the same slot of order_ids
+    size_t order_table_mask;
+    LatencyHistogram *stage_latency; //arrival to each status, STATUS_COUNT histograms
+} LoadThread;
+
+// Global variables
+struct sockaddr_in server_addr; //server address
+int num_clients; //orders to place
+int town_size_x, town_size_y;
+int thread_count = 1; //generator threads
+int connections = 0; //framed connections, 0 for one legacy connection per order
+int subscription = -1; //SubscriptionLevel sent to the shop, -1 to keep its default
+ArrivalMode arrival = ARRIVAL_CLOSED;
+double arrival_rate = 0; //orders per second of the constant and Poisson modes
+int burst_size = 100; //orders per burst
+int burst_interval_ms = 1000; //time between bursts
+SpatialMode spatial = SPATIAL_UNIFORM;
+int hotspot_count = DEFAULT_HOTSPOTS;
+int (*hotspots)[2]; //centers of the hotspots
+bool quiet = false; //skip the line per status change
+char *results_path = NULL; //CSV file the summary is appended to
+uint64_t *arrival_ns; //scheduled arrival of every order, latencies are measured from it
+uint64_t start_ns; //time the first order is due
+LoadThread *load_threads;
+volatile sig_atomic_t stopping = 0; //set by SIGINT or SIGQUIT
+atomic_int shop_hung_up; //the shop closed a connection before its orders were done
+
+int parse_arguments(int argc, char *argv[]);
+uint64_t now_ns();
+void *generator_routine(void *arg);
+uint64_t next_arrival(LoadThread *load_thread, int order);
+void pick_address(LoadThread *load_thread, int *x, int *y);
+void place_legacy_order(LoadThread *load_thread, int order);
+void handle_legacy_event(LoadThread *load_thread, LegacyOrder *legacy);
+void finish_legacy_order(LoadThread *load_thread, LegacyOrder *legacy);
+void cancel_legacy_orders(LoadThread *load_thread);
+int open_mux_connections(LoadThread *load_thread);
+void queue_mux_order(LoadThread *load_thread, int order);
+int flush_mux_orders(LoadThread *load_thread, MuxConnection *connection);
+int write_mux_output(LoadThread *load_thread, MuxConnection *connection);
+void record_status(LoadThread *load_thread, int client, int status);
+void print_status(int client, int status);
+void put_order_client(LoadThread *load_thread, uint32_t order_id, int client);
+int get_order_client(LoadThread *load_thread, uint32_t order_id);
+int send_all(int socket, const void *data, size_t size);
+int recv_all(int socket, void *data, size_t size);
+int handle_status_frame(LoadThread *load_thread, MuxConnection *connection, const StatusFrame *frame);
+int read_status_frames(LoadThread *load_thread, MuxConnection *connection);
+void print_stage_latency(double orders_per_second);
+
+//handling shutdown signals (SIGINT, SIGQUIT), the generator threads cancel their orders and exit
 void signal_handler(int signal) {
     if (signal == SIGINT || signal == SIGQUIT) {
-        printf("Client shutting down...\n");
-        //loop through all client sockets and send cancel signal if active
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (client_sockets[i] != -1) {
-                printf("Order %d is canceled\n", i + 1);
-                int cancel_status = 6; //status code for canceling the order
-                send(client_sockets[i], &cancel_status, sizeof(int), 0); //send cancel status to client
-                close(client_sockets[i]); //close the socket
-                client_sockets[i] = -1; //mark socket as closed
-            }
-        }
-        exit(0); 
+        stopping = 1;
     }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 6) { //check if the correct number of arguments is provided
-        printf("Usage: %s <server_ip> <port> <num_clients> <town_size_x> <town_size_y>\n", argv[0]);
+    if (parse_arguments(argc, argv) < 0) {
+        printf("Usage: %s <server_ip> <port> <num_clients> <town_size_x> <town_size_y> [--threads N] [--multiplex CONNECTIONS] "
+               "[--subscribe full|milestones|final] [--arrival closed|constant|poisson|burst] [--rate R] [--burst-size N] "
+               "[--burst-interval-ms N] [--spatial uniform|center|hotspots] [--hotspots N] [--quiet] [--results FILE]\n", argv[0]);
         return 1;
     }
 
-    char *server_ip = argv[1]; //server IP address
-    int port = atoi(argv[2]); //server port number
-    int num_clients = atoi(argv[3]); //number of clients
+    srand(time(NULL));
 
-    if (num_clients > MAX_CLIENTS) { //limit the number of clients if it exceeds the maximum
-        printf("Warning: Limiting number of clients to %d\n", MAX_CLIENTS);
-        num_clients = MAX_CLIENTS;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigaction(SIGINT, &action, NULL); //register signal handler for SIGINT
+    sigaction(SIGQUIT, &action, NULL); //register signal handler for SIGQUIT
+    signal(SIGPIPE, SIG_IGN); //a shop that hangs up shows as a failed send
+
+    //one descriptor per legacy order, use every descriptor the hard limit allows
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
     }
 
-    int town_size_x = atoi(argv[4]); //town size x
-    int town_size_y = atoi(argv[5]); //town size y
+    hotspots = malloc(hotspot_count * sizeof(*hotspots));
+    arrival_ns = calloc(num_clients, sizeof(uint64_t));
+    load_threads = calloc(thread_count, sizeof(LoadThread));
+    if (hotspots == NULL || arrival_ns == NULL || load_threads == NULL) {
+        printf("Failed to allocate orders\n");
+        return 1;
+    }
+    for (int i = 0; i < hotspot_count; i++) {
+        hotspots[i][0] = rand() % town_size_x;
+        hotspots[i][1] = rand() % town_size_y;
+    }
 
-    srand(time(NULL)); 
+    //framed connections are opened before the clock starts so the handshakes do not count as latency
+    for (int t = 0; t < thread_count; t++) {
+        LoadThread *load_thread = &load_threads[t];
+        load_thread->id = t;
+        load_thread->order_count = num_clients / thread_count + (t < num_clients % thread_count);
+        load_thread->seed = rand();
+        load_thread->epoll_fd = epoll_create1(0);
+        load_thread->stage_latency = malloc(STATUS_COUNT * sizeof(LatencyHistogram));
+        if (load_thread->epoll_fd < 0 || load_thread->stage_latency == NULL) {
+            printf("Failed to create generator thread %d\n", t + 1);
+            return 1;
+        }
+        for (int s = 0; s < STATUS_COUNT; s++) histogram_init(&load_thread->stage_latency[s]);
+        if (connections > 0 && open_mux_connections(load_thread) < 0) return 1;
+    }
 
-    signal(SIGINT, signal_handler); //register signal handler for SIGINT
-    signal(SIGQUIT, signal_handler); //register signal handler for SIGQUIT
+    start_ns = now_ns();
+    for (int t = 0; t < thread_count; t++) {
+        if (pthread_create(&load_threads[t].thread, NULL, generator_routine, &load_threads[t]) != 0) {
+            printf("Failed to create generator thread %d\n", t + 1);
+            return 1;
+        }
+    }
 
-    //initialize client sockets array to -1 (indicating no connection)
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        client_sockets[i] = -1;
+    int placed = 0, finished = 0, failed = 0;
+    for (int t = 0; t < thread_count; t++) {
+        pthread_join(load_threads[t].thread, NULL);
+        placed += load_threads[t].placed;
+        finished += load_threads[t].finished;
+        failed += load_threads[t].failed;
     }
+    double seconds = (now_ns() - start_ns) / 1e9;
 
-    // Loop to initialize and connect clients
-    for (int i = 0; i < num_clients; i++) {
-        int x = rand() % town_size_x; 
-        int y = rand() % town_size_y; 
-        client_sockets[i] = socket(AF_INET, SOCK_STREAM, 0); //create a new socket for the client
-        if (client_sockets[i] < 0) { //check if socket creation failed
-            printf("Failed to create socket for client %d\n", i + 1);
-            continue;
+    if (atomic_load(&shop_hung_up)) {
+        printf("RIP PIDE SHOP ...\n");
+    } else if (!stopping) {
+        printf("All orders processed. Shutting down client.\n");
+    }
+    printf("Client shutting down...\n");
+    printf("Placed %d orders in %.3f s (%.1f orders/s) with %d threads, %d finished, %d failed to reach the shop\n",
+           placed, seconds, placed / seconds, thread_count, finished - failed, failed);
+    print_stage_latency(placed / seconds);
+    return 0;
+}
+
+//read the positional arguments and options, returns -1 on a bad command line
+int parse_arguments(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"multiplex", required_argument, NULL, 'm'},
+        {"subscribe", required_argument, NULL, 's'},
+        {"arrival", required_argument, NULL, 'a'},
+        {"rate", required_argument, NULL, 'r'},
+        {"burst-size", required_argument, NULL, 'B'},
+        {"burst-interval-ms", required_argument, NULL, 'I'},
+        {"spatial", required_argument, NULL, 'd'},
+        {"hotspots", required_argument, NULL, 'H'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"results", required_argument, NULL, 'R'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:m:s:a:r:B:I:d:H:qR:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                thread_count = atoi(optarg);
+                if (thread_count <= 0 || thread_count > MAX_THREADS) return -1;
+                break;
+            case 'm':
+                connections = atoi(optarg);
+                if (connections <= 0 || connections > MAX_CONNECTIONS) return -1;
+                break;
+            case 's':
+                if (strcmp(optarg, "full") == 0) subscription = SUBSCRIBE_FULL;
+                else if (strcmp(optarg, "milestones") == 0) subscription = SUBSCRIBE_MILESTONES;
+                else if (strcmp(optarg, "final") == 0) subscription = SUBSCRIBE_FINAL;
+                else return -1;
+                break;
+            case 'a':
+                if (strcmp(optarg, "closed") == 0) arrival = ARRIVAL_CLOSED;
+                else if (strcmp(optarg, "constant") == 0) arrival = ARRIVAL_CONSTANT;
+                else if (strcmp(optarg, "poisson") == 0) arrival = ARRIVAL_POISSON;
+                else if (strcmp(optarg, "burst") == 0) arrival = ARRIVAL_BURST;
+                else return -1;
+                break;
+            case 'r':
+                arrival_rate = atof(optarg);
+                if (arrival_rate <= 0) return -1;
+                break;
+            case 'B':
+                burst_size = atoi(optarg);
+                if (burst_size <= 0) return -1;
+                break;
+            case 'I':
+                burst_interval_ms = atoi(optarg);
+                if (burst_interval_ms < 0) return -1;
+                break;
+            case 'd':
+                if (strcmp(optarg, "uniform") == 0) spatial = SPATIAL_UNIFORM;
+                else if (strcmp(optarg, "center") == 0) spatial = SPATIAL_CENTER;
+                else if (strcmp(optarg, "hotspots") == 0) spatial = SPATIAL_HOTSPOTS;
+                else return -1;
+                break;
+            case 'H':
+                hotspot_count = atoi(optarg);
+                if (hotspot_count <= 0) return -1;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 'R':
+                results_path = optarg;
+                break;
+            default:
+                return -1;
         }
+    }
+    if (argc - optind != 5) return -1; //check if the correct number of arguments is provided
+    if ((arrival == ARRIVAL_CONSTANT || arrival == ARRIVAL_POISSON) && arrival_rate <= 0) {
+        printf("--arrival constant and poisson need --rate\n");
+        return -1;
+    }
 
-        struct sockaddr_in server_addr; //server address structure
-        memset(&server_addr, 0, sizeof(server_addr)); //clear the server address structure
-        server_addr.sin_family = AF_INET; //set address family to AF_INET
-        server_addr.sin_port = htons(port); //set server port
-        inet_pton(AF_INET, server_ip, &server_addr.sin_addr); //convert and set server IP address
+    memset(&server_addr, 0, sizeof(server_addr)); //clear the server address structure
+    server_addr.sin_family = AF_INET; //set address family to AF_INET
+    server_addr.sin_port = htons(atoi(argv[optind + 1])); //set server port
+    if (inet_pton(AF_INET, argv[optind], &server_addr.sin_addr) != 1) return -1; //convert and set server IP address
 
-        //attempt to connect to the server
-        if (connect(client_sockets[i], (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-            printf("Failed to connect client to server\n");
-            close(client_sockets[i]); //close the socket if connection fails
-            client_sockets[i] = -1; //mark socket as closed
-            raise(SIGINT); //raise SIGINT signal to shutdown
+    num_clients = atoi(argv[optind + 2]); //number of clients
+    town_size_x = atoi(argv[optind + 3]); //town size x
+    town_size_y = atoi(argv[optind + 4]); //town size y
+    if (num_clients <= 0 || town_size_x <= 0 || town_size_y <= 0) return -1;
+    if (num_clients > MAX_ORDERS) { //limit the number of clients if it exceeds the maximum
+        printf("Warning: Limiting number of clients to %d\n", MAX_ORDERS);
+        num_clients = MAX_ORDERS;
+    }
+
+    if (subscription >= 0 && connections == 0) connections = 1; //only the framed protocol can subscribe
+    if (connections > num_clients) connections = num_clients;
+    if (connections > 0 && thread_count > connections) thread_count = connections; //every thread needs a connection
+    if (thread_count > num_clients) thread_count = num_clients;
+    return 0;
+}
+
+//monotonic clock in nanoseconds
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//place the orders of a thread on schedule and read their statuses until every one is done
+void *generator_routine(void *arg) {
+    LoadThread *load_thread = (LoadThread *)arg;
+    struct epoll_event events[MAX_GENERATOR_EVENTS];
+    int order = load_thread->id; //orders of this thread are id, id + thread_count, ...
+    uint64_t due = next_arrival(load_thread, order);
+
+    while (!stopping && !atomic_load(&shop_hung_up) && load_thread->finished < load_thread->order_count) {
+        //place every order that is due, latencies count from the schedule so a late loop is not hidden
+        uint64_t now = now_ns();
+        while (load_thread->placed < load_thread->order_count && due <= now) {
+            arrival_ns[order] = due;
+            if (connections > 0) {
+                queue_mux_order(load_thread, order);
+            } else {
+                place_legacy_order(load_thread, order);
+            }
+            load_thread->placed++;
+            order += thread_count;
+            if (load_thread->placed < load_thread->order_count) due = next_arrival(load_thread, order);
+        }
+        for (int c = 0; c < load_thread->connection_count; c++) {
+            if (flush_mux_orders(load_thread, load_thread->connections[c]) < 0) atomic_store(&shop_hung_up, 1);
+        }
+
+        int timeout = STOP_CHECK_MS;
+        if (load_thread->placed < load_thread->order_count) {
+            now = now_ns();
+            uint64_t wait_ms = due > now ? (due - now) / 1000000 : 0;
+            if (wait_ms < (uint64_t)timeout) timeout = wait_ms;
+        }
+        int event_count = epoll_wait(load_thread->epoll_fd, events, MAX_GENERATOR_EVENTS, timeout);
+        if (event_count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            if (connections == 0) {
+                handle_legacy_event(load_thread, events[i].data.ptr);
+                continue;
+            }
+            MuxConnection *connection = events[i].data.ptr;
+            if ((events[i].events & EPOLLOUT) && write_mux_output(load_thread, connection) < 0) atomic_store(&shop_hung_up, 1);
+            if ((events[i].events & ~EPOLLOUT) && read_status_frames(load_thread, connection) < 0) {
+                atomic_store(&shop_hung_up, 1); //the shop hung up before every order was done
+            }
         }
+    }
+
+    //cancel the orders still in progress, the shop also drops the orders of a closed framed connection
+    cancel_legacy_orders(load_thread);
+    for (int c = 0; c < load_thread->connection_count; c++) {
+        close(load_thread->connections[c]->socket);
+    }
+    close(load_thread->epoll_fd);
+    return NULL;
+}
 
-        //send coordinates to the server
-        if (send(client_sockets[i], &x, sizeof(int), 0) < 0 || send(client_sockets[i], &y, sizeof(int), 0) < 0) {
-            printf("Failed to send order coordinates for client %d\n", i + 1);
-            close(client_sockets[i]); //close the socket if sending fails
-            client_sockets[i] = -1; //mark socket as closed
-        } else {
-            printf("Order placed at (%d, %d) for client %d\n", x, y, i + 1); //confirm order placement
+//scheduled arrival of an order
+uint64_t next_arrival(LoadThread *load_thread, int order) {
+    switch (arrival) {
+        case ARRIVAL_CONSTANT:
+            return start_ns + (uint64_t)(order * 1e9 / arrival_rate);
+        case ARRIVAL_POISSON: {
+            //every thread runs its own Poisson process at its share of the rate, together they are one at the full rate
+            double uniform = (rand_r(&load_thread->seed) + 1.0) / (RAND_MAX + 2.0);
+            load_thread->poisson_ns += (uint64_t)(-log(uniform) * 1e9 * thread_count / arrival_rate);
+            return start_ns + load_thread->poisson_ns;
         }
+        case ARRIVAL_BURST:
+            return start_ns + (uint64_t)(order / burst_size) * burst_interval_ms * 1000000ull;
+        default:
+            return start_ns;
+    }
+}
+
+//delivery address of a new order
+void pick_address(LoadThread *load_thread, int *x, int *y) {
+    if (spatial == SPATIAL_UNIFORM) {
+        *x = rand_r(&load_thread->seed) % town_size_x;
+        *y = rand_r(&load_thread->seed) % town_size_y;
+        return;
+    }
+
+    //Box-Muller, one normal pair per address
+    double u1 = (rand_r(&load_thread->seed) + 1.0) / (RAND_MAX + 2.0);
+    double u2 = rand_r(&load_thread->seed) / (RAND_MAX + 1.0);
+    double radius = sqrt(-2 * log(u1));
+    double gx = radius * cos(2 * M_PI * u2), gy = radius * sin(2 * M_PI * u2);
+
+    double cx = town_size_x / 2.0, cy = town_size_y / 2.0, spread = 6; //the town spans about six standard deviations
+    if (spatial == SPATIAL_HOTSPOTS) {
+        int hotspot = rand_r(&load_thread->seed) % hotspot_count;
+        cx = hotspots[hotspot][0];
+        cy = hotspots[hotspot][1];
+        spread = 16;
+    }
+    *x = (int)lround(cx + gx * town_size_x / spread);
+    *y = (int)lround(cy + gy * town_size_y / spread);
+    *x = *x < 0 ? 0 : *x >= town_size_x ? town_size_x - 1 : *x;
+    *y = *y < 0 ? 0 : *y >= town_size_y ? town_size_y - 1 : *y;
+}
+
+//open a connection for the order and start connecting, the coordinates are sent once it is connected
+void place_legacy_order(LoadThread *load_thread, int order) {
+    LegacyOrder *legacy = calloc(1, sizeof(LegacyOrder));
+    if (legacy == NULL) {
+        printf("Failed to allocate order for client %d\n", order + 1);
+        load_thread->failed++;
+        load_thread->finished++;
+        return;
+    }
+    legacy->client = order + 1;
+    pick_address(load_thread, &legacy->x, &legacy->y);
+    legacy->next = load_thread->live_orders;
+    if (legacy->next != NULL) legacy->next->prev = legacy;
+    load_thread->live_orders = legacy;
+
+    legacy->socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0); //create a new socket for the client
+    if (legacy->socket < 0) { //check if socket creation failed
+        printf("Failed to create socket for client %d\n", legacy->client);
+        load_thread->failed++;
+        finish_legacy_order(load_thread, legacy);
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLOUT;
+    event.data.ptr = legacy;
+    int result = connect(legacy->socket, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    if ((result < 0 && errno != EINPROGRESS) || epoll_ctl(load_thread->epoll_fd, EPOLL_CTL_ADD, legacy->socket, &event) < 0) {
+        printf("Failed to connect client %d to server\n", legacy->client);
+        load_thread->failed++;
+        finish_legacy_order(load_thread, legacy);
     }
+}
 
-    fd_set readfds; //set of file descriptors for select
-    int canceled_flag = 0; //flag to indicate if an order was canceled
+//the connection of a legacy order is established, or statuses arrived on it
+void handle_legacy_event(LoadThread *load_thread, LegacyOrder *legacy) {
+    if (!legacy->connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(legacy->socket, SOL_SOCKET, SO_ERROR, &error, &length);
+        int request[2] = {legacy->x, legacy->y};
+        if (error != 0 || send(legacy->socket, request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)) {
+            printf("Failed to send order coordinates for client %d\n", legacy->client);
+            load_thread->failed++;
+            finish_legacy_order(load_thread, legacy);
+            return;
+        }
+        if (!quiet) printf("Order placed at (%d, %d) for client %d\n", legacy->x, legacy->y, legacy->client); //confirm order placement
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = legacy;
+        epoll_ctl(load_thread->epoll_fd, EPOLL_CTL_MOD, legacy->socket, &event);
+        legacy->connected = true;
+        return;
+    }
 
-    //handle communication with the server
     while (1) {
-        FD_ZERO(&readfds); //clear the set of file descriptors
+        ssize_t n = recv(legacy->socket, legacy->buffer + legacy->received, sizeof(int) - legacy->received, MSG_DONTWAIT); //receive order status
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { //the connection was closed or failed
+            if (n < 0) perror("recv");
+            atomic_store(&shop_hung_up, 1);
+            finish_legacy_order(load_thread, legacy);
+            return;
+        }
+        legacy->received += n;
+        if (legacy->received < sizeof(int)) continue;
 
-        //add client sockets to the set
-        for (int i = 0; i < num_clients; i++) {
-            if (client_sockets[i] != -1) {
-                FD_SET(client_sockets[i], &readfds);
-            }
+        int order_status;
+        memcpy(&order_status, legacy->buffer, sizeof(int));
+        legacy->received = 0;
+        record_status(load_thread, legacy->client, order_status);
+        if (order_status >= 5) {
+            finish_legacy_order(load_thread, legacy); //close the socket after delivery, cancellation or a busy shop
+            return;
         }
+    }
+}
 
-        int activity = select(FD_SETSIZE, &readfds, NULL, NULL, NULL); //wait for activity on any socket
-
-        if (activity < 0) { //check if select failed
-            perror("select");
-            exit(1);
-        }
-
-        //loop through clients to check for activity
-        for (int i = 0; i < num_clients; i++) {
-            if (client_sockets[i] != -1 && FD_ISSET(client_sockets[i], &readfds)) { //check if the socket has activity
-                int order_status;
-                int recv_result = recv(client_sockets[i], &order_status, sizeof(int), 0); //receive order status
-
-                if (recv_result > 0) { //check if data was received
-                    switch (order_status) {
-                        case 0:
-                            printf("Order placed for client %d\n", i + 1);
-                            break;
-                        case 1:
-                            printf("Order for client %d is being prepared\n", i + 1);
-                            break;
-                        case 2:
-                            printf("Order for client %d is get order into apparatus\n", i + 1);
-                            printf("Order for client %d is being cooked\n", i + 1);
-                            break;
-                        case 3:
-                            printf("Order for client %d is get order into apparatus\n", i + 1);
-                            printf("Order for client %d is ready for delivery\n", i + 1);
-                            break;
-                        case 4:
-                            printf("Order for client %d is out for delivery\n", i + 1);
-                            break;
-                        case 5:
-                            printf("Order for client %d has been delivered\n", i + 1);
-                            close(client_sockets[i]); //close the socket after delivery
-                            client_sockets[i] = -1; //mark socket as closed
-                            break;
-                        case 6:
-                            printf("Order for client %d has been canceled\n", i + 1);
-                            close(client_sockets[i]); //close the socket after cancellation
-                            client_sockets[i] = -1; //mark socket as closed
-                            break;
-                        default:
-                            printf("Unknown status for order of client %d\n", i + 1);
-                            break;
-                    }
-                } else if (recv_result == 0) { //check if the connection was closed
-                    close(client_sockets[i]); //close the socket
-                    client_sockets[i] = -1; //mark socket as closed
-                    canceled_flag = 1; //set the cancel flag
-                } else { //chek error
-                    perror("recv");
-                    close(client_sockets[i]); //close the socket
-                    client_sockets[i] = -1; //mark socket as closed
-                }
-            }
+//close the connection of a delivered, canceled or failed legacy order
+void finish_legacy_order(LoadThread *load_thread, LegacyOrder *legacy) {
+    if (legacy->prev != NULL) legacy->prev->next = legacy->next;
+    else load_thread->live_orders = legacy->next;
+    if (legacy->next != NULL) legacy->next->prev = legacy->prev;
+
+    if (legacy->socket >= 0) close(legacy->socket); //closing also removes it from the epoll set
+    free(legacy);
+    load_thread->finished++;
+}
+
+//send a cancel status for every legacy order still in progress and close its socket
+void cancel_legacy_orders(LoadThread *load_thread) {
+    while (load_thread->live_orders != NULL) {
+        LegacyOrder *legacy = load_thread->live_orders;
+        if (legacy->connected) {
+            if (!quiet) printf("Order %d is canceled\n", legacy->client);
+            int cancel_status = 6; //status code for canceling the order
+            send(legacy->socket, &cancel_status, sizeof(int), MSG_NOSIGNAL | MSG_DONTWAIT); //send cancel status to the shop
         }
+        finish_legacy_order(load_thread, legacy);
+    }
+}
+
+//connect the framed connections of a thread and agree on the protocol version, connection c belongs to thread c % thread_count
+int open_mux_connections(LoadThread *load_thread) {
+    load_thread->connection_count = connections / thread_count + (load_thread->id < connections % thread_count);
+    load_thread->connections = calloc(load_thread->connection_count, sizeof(MuxConnection *));
+    size_t table_size = 2;
+    while (table_size < (size_t)load_thread->order_count * 2) table_size <<= 1;
+    load_thread->order_ids = calloc(table_size, sizeof(int));
+    load_thread->order_clients = calloc(table_size, sizeof(int));
+    load_thread->order_table_mask = table_size - 1;
+    if (load_thread->connections == NULL || load_thread->order_ids == NULL || load_thread->order_clients == NULL) {
+        printf("Failed to allocate connections\n");
+        return -1;
+    }
 
-        if (canceled_flag == 1) { //check if any order was canceled
-            printf("RIP PIDE SHOP ...\n");
-            raise(SIGINT); //raise SIGINT signal to shutdown
+    for (int c = 0; c < load_thread->connection_count; c++) {
+        MuxConnection *connection = calloc(1, sizeof(MuxConnection));
+        int orders = load_thread->order_count / load_thread->connection_count + 1;
+        if (connection == NULL || (connection->clients = malloc(orders * sizeof(int))) == NULL) {
+            printf("Failed to allocate connections\n");
+            return -1;
+        }
+        load_thread->connections[c] = connection;
+        connection->socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (connection->socket < 0 || connect(connection->socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+            printf("Failed to connect client to server\n");
+            return -1;
         }
 
-        //check if all sockets are closed
-        bool all_sockets_closed = true;
-        for (int i = 0; i < num_clients; i++) {
-            if (client_sockets[i] != -1) {
-                all_sockets_closed = false;
-                break;
-            }
+        ProtocolHello hello = {PROTOCOL_MAGIC, PROTOCOL_VERSION};
+        if (send_all(connection->socket, &hello, sizeof(hello)) < 0 || recv_all(connection->socket, &hello, sizeof(hello)) < 0 ||
+            hello.magic != PROTOCOL_MAGIC || hello.version != PROTOCOL_VERSION) {
+            printf("Server does not speak protocol version %d\n", PROTOCOL_VERSION);
+            return -1;
         }
 
-        if (all_sockets_closed) { //if all sockets are closed, shut down the client
-            printf("All orders processed. Shutting down client.\n");
-            raise(SIGINT); //raise SIGINT signal to shutdown
+        //the level applies to every order sent after it
+        struct {
+            FrameHeader header;
+            uint32_t level;
+        } subscribe = {{sizeof(uint32_t), FRAME_SUBSCRIBE}, (uint32_t)subscription};
+        if (subscription >= 0 && send_all(connection->socket, &subscribe, sizeof(subscribe)) < 0) {
+            printf("Failed to subscribe over connection %d\n", load_thread->id + c * thread_count + 1);
+            return -1;
         }
+
+        //orders go out from the epoll loop from here on
+        fcntl(connection->socket, F_SETFL, fcntl(connection->socket, F_GETFL, 0) | O_NONBLOCK);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        epoll_ctl(load_thread->epoll_fd, EPOLL_CTL_ADD, connection->socket, &event);
     }
+    return 0;
+}
+
+//add an order to the next frame of the next connection of the thread
+void queue_mux_order(LoadThread *load_thread, int order) {
+    MuxConnection *connection = load_thread->connections[load_thread->next_connection];
+    load_thread->next_connection = (load_thread->next_connection + 1) % load_thread->connection_count;
+    if (connection->pending_count == MAX_FRAME_ORDERS && flush_mux_orders(load_thread, connection) < 0) atomic_store(&shop_hung_up, 1);
+
+    int x, y;
+    pick_address(load_thread, &x, &y);
+    connection->pending[connection->pending_count].x = x;
+    connection->pending[connection->pending_count].y = y;
+    connection->pending_clients[connection->pending_count++] = order + 1;
+}
 
-    //close all client sockets before exiting
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_sockets[i] != -1) {
-            close(client_sockets[i]);
+//send the orders waiting for a connection in one frame, behind the frames the shop has not taken yet
+int flush_mux_orders(LoadThread *load_thread, MuxConnection *connection) {
+    if (connection->pending_count == 0) return 0;
+
+    FrameHeader header = {connection->pending_count * sizeof(OrderRequest), FRAME_ORDERS};
+    size_t needed = connection->output_length + sizeof(header) + header.length;
+    if (needed > connection->output_capacity) {
+        size_t capacity = connection->output_capacity > 0 ? connection->output_capacity : sizeof(FrameHeader) + MAX_FRAME_PAYLOAD;
+        while (capacity < needed) capacity *= 2;
+        unsigned char *output = realloc(connection->output, capacity);
+        if (output == NULL) {
+            printf("Failed to buffer orders for the shop\n");
+            return -1;
+        }
+        connection->output = output;
+        connection->output_capacity = capacity;
+    }
+    memcpy(connection->output + connection->output_length, &header, sizeof(header));
+    memcpy(connection->output + connection->output_length + sizeof(header), connection->pending, header.length);
+    connection->output_length = needed;
+    memcpy(connection->clients + connection->order_count, connection->pending_clients, connection->pending_count * sizeof(int));
+    connection->order_count += connection->pending_count;
+    connection->pending_count = 0;
+    return connection->waiting_output ? 0 : write_mux_output(load_thread, connection);
+}
+
+//write as much of the buffered frames as the socket takes and watch EPOLLOUT for the rest
+int write_mux_output(LoadThread *load_thread, MuxConnection *connection) {
+    while (connection->output_sent < connection->output_length) {
+        ssize_t n = send(connection->socket, connection->output + connection->output_sent, connection->output_length - connection->output_sent,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            connection->output_sent += n;
+            continue;
         }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break; //the shop is not reading, keep placing and reading statuses
+        printf("Failed to send orders to the shop\n");
+        return -1;
     }
 
+    bool waiting = connection->output_sent < connection->output_length;
+    if (!waiting) connection->output_sent = connection->output_length = 0;
+    if (waiting != connection->waiting_output) {
+        struct epoll_event event;
+        event.events = waiting ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        event.data.ptr = connection;
+        epoll_ctl(load_thread->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event);
+        connection->waiting_output = waiting;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+//count a status change of an order and the time since it was due
+void record_status(LoadThread *load_thread, int client, int status) {
+    if (!quiet) print_status(client, status);
+    if (status < 0 || status >= STATUS_COUNT || client <= 0) return;
+    histogram_record(&load_thread->stage_latency[status], now_ns() - arrival_ns[client - 1]);
+}
+
+//print a status change of the order of a client
+void print_status(int client, int status) {
+    switch (status) {
+        case 0:
+            printf("Order placed for client %d\n", client);
+            break;
+        case 1:
+            printf("Order for client %d is being prepared\n", client);
+            break;
+        case 2:
+            printf("Order for client %d is get order into apparatus\n", client);
+            printf("Order for client %d is being cooked\n", client);
+            break;
+        case 3:
+            printf("Order for client %d is get order into apparatus\n", client);
+            printf("Order for client %d is ready for delivery\n", client);
+            break;
+        case 4:
+            printf("Order for client %d is out for delivery\n", client);
+            break;
+        case 5:
+            printf("Order for client %d has been delivered\n", client);
+            break;
+        case 6:
+            printf("Order for client %d has been canceled\n", client);
+            break;
+        case 7:
+            printf("Shop is busy, order for client %d was turned away\n", client);
+            break;
+        default:
+            printf("Unknown status for order of client %d\n", client);
+            break;
+    }
+}
+
+//remember which client an order id belongs to
+void put_order_client(LoadThread *load_thread, uint32_t order_id, int client) {
+    size_t slot = order_id & load_thread->order_table_mask;
+    while (load_thread->order_ids[slot] != 0 && load_thread->order_ids[slot] != (int)order_id) slot = (slot + 1) & load_thread->order_table_mask;
+    load_thread->order_ids[slot] = order_id;
+    load_thread->order_clients[slot] = client;
+}
+
+//client an order id belongs to, 0 if the id is unknown
+int get_order_client(LoadThread *load_thread, uint32_t order_id) {
+    size_t slot = order_id & load_thread->order_table_mask;
+    while (load_thread->order_ids[slot] != 0) {
+        if (load_thread->order_ids[slot] == (int)order_id) return load_thread->order_clients[slot];
+        slot = (slot + 1) & load_thread->order_table_mask;
+    }
+    return 0;
+}
+
+//write all bytes to a socket
+int send_all(int socket, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    while (size > 0) {
+        ssize_t n = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+//read exactly size bytes from a socket
+int recv_all(int socket, void *data, size_t size) {
+    unsigned char *bytes = data;
+    while (size > 0) {
+        ssize_t n = recv(socket, bytes, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+//handle a status frame, returns 1 once the order is delivered, canceled or turned away
+int handle_status_frame(LoadThread *load_thread, MuxConnection *connection, const StatusFrame *frame) {
+    int client;
+    if (frame->status == 0 || (frame->order_id == 0 && connection->accepted < connection->order_count)) {
+        //answers to requests come back in the order they were sent and carry the id the shop gave them
+        client = connection->clients[connection->accepted++];
+        if (frame->order_id != 0) put_order_client(load_thread, frame->order_id, client);
+    } else {
+        client = get_order_client(load_thread, frame->order_id);
+    }
+    record_status(load_thread, client, frame->status);
+    return frame->status >= 5;
+}
+
+//read every status frame that has arrived on a connection, returns -1 if the shop hung up
+int read_status_frames(LoadThread *load_thread, MuxConnection *connection) {
+    while (1) {
+        ssize_t n = recv(connection->socket, connection->buffer + connection->received, sizeof(StatusFrame) - connection->received, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        connection->received += n;
+        if (connection->received < sizeof(StatusFrame)) continue;
+
+        StatusFrame frame;
+        memcpy(&frame, connection->buffer, sizeof(frame));
+        connection->received = 0;
+        if (frame.header.type != FRAME_STATUS || frame.header.length != sizeof(frame) - sizeof(FrameHeader)) {
+            printf("Unexpected frame from the shop\n");
+            return -1;
+        }
+        int done = handle_status_frame(load_thread, connection, &frame);
+        connection->finished += done;
+        load_thread->finished += done;
+    }
+}
+
+//print the end-to-end latency of every status, measured from the scheduled arrival of the order.
+//with --results the same numbers are appended as CSV rows: stage,orders,orders_per_s,mean_ms,p50_ms,p99_ms,p999_ms,max_ms
+void print_stage_latency(double orders_per_second) {
+    static const char *names[STATUS_COUNT] = {"received", "preparing", "cooking", "ready", "out for delivery", "delivered", "canceled", "busy"};
+    FILE *results = NULL;
+    if (results_path != NULL && (results = fopen(results_path, "a")) == NULL) perror("fopen results");
+
+    for (int s = 0; s < STATUS_COUNT; s++) {
+        LatencyHistogram stage;
+        histogram_init(&stage);
+        for (int t = 0; t < thread_count; t++) histogram_merge(&stage, &load_threads[t].stage_latency[s]);
+        if (atomic_load(&stage.count) == 0) continue;
+
+        unsigned long long count = atomic_load(&stage.count);
+        double mean = histogram_mean(&stage) / 1e6, max = atomic_load(&stage.max) / 1e6;
+        double p50 = histogram_percentile(&stage, 50) / 1e6, p99 = histogram_percentile(&stage, 99) / 1e6;
+        double p999 = histogram_percentile(&stage, 99.9) / 1e6;
+        printf("Status %d %-16s over %llu orders: mean %.3f ms, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n", s, names[s],
+               count, mean, p50, p99, p999, max);
+        if (results != NULL) {
+            fprintf(results, "%d,%llu,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n", s, count, orders_per_second, mean, p50, p99, p999, max);
+        }
+    }
+    if (results != NULL) fclose(results);
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "orderJournal.h"
+
+//offline decoder for the binary order journal written by PideShop --journal
+
+#define STATUS_COUNT 7 //statuses 0..6
+#define STAGE_COUNT 5 //transitions between consecutive statuses 0..5
+
+typedef enum { MODE_TEXT, MODE_CSV, MODE_SUMMARY } OutputMode;
+
+//growable list of durations for one stage
+typedef struct {
+    uint64_t *values;
+    size_t count, capacity;
+} DurationList;
+
+static const char *stage_names[STAGE_COUNT] = {
+    "received->preparing",
+    "preparing->cooking",
+    "cooking->ready",
+    "ready->out for delivery",
+    "out for delivery->delivered"
+};
+
+static uint64_t first_timestamp = 0;
+static int have_first = 0;
+static uint64_t status_counts[STATUS_COUNT + 1]; //last slot counts unknown statuses
+static DurationList stages[STAGE_COUNT];
+static uint64_t *last_timestamp; //per order id, time of its last status
+static int *last_status; //per order id, last status seen or -1
+static size_t tracked_orders = 0;
+
+static const char *status_string(int status) {
+    switch (status) {
+        case 0:
+            return "Order received";
+        case 1:
+            return "Preparing";
+        case 2:
+            return "Cooking";
+        case 3:
+            return "Ready for delivery";
+        case 4:
+            return "Out for delivery";
+        case 5:
+            return "Delivered";
+        case 6:
+            return "Canceled";
+        default:
+            return "Unknown status";
+    }
+}
+
+static void add_duration(DurationList *list, uint64_t value) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->values = realloc(list->values, list->capacity * sizeof(uint64_t));
+        if (list->values == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    list->values[list->count++] = value;
+}
+
+//make sure per order arrays cover order_id
+static void track_order(int order_id) {
+    if ((size_t)order_id < tracked_orders) return;
+    size_t size = tracked_orders ? tracked_orders : 1024;
+    while (size <= (size_t)order_id) size *= 2;
+    last_timestamp = realloc(last_timestamp, size * sizeof(uint64_t));
+    last_status = realloc(last_status, size * sizeof(int));
+    if (last_timestamp == NULL || last_status == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    for (size_t i = tracked_orders; i < size; i++) last_status[i] = -1;
+    tracked_orders = size;
+}
+
+static void summarize(const JournalRecord *record) {
+    int status = record->status;
+    status_counts[status >= 0 && status < STATUS_COUNT ? status : STATUS_COUNT]++;
+    if (record->order_id < 0) return;
+
+    track_order(record->order_id);
+    int previous = last_status[record->order_id];
+    if (previous >= 0 && status == previous + 1 && status <= STAGE_COUNT) {
+        add_duration(&stages[previous], record->timestamp_ns - last_timestamp[record->order_id]);
+    }
+    last_status[record->order_id] = status;
+    last_timestamp[record->order_id] = record->timestamp_ns;
+}
+
+static void print_record(const JournalRecord *record, OutputMode mode) {
+    if (!have_first) {
+        first_timestamp = record->timestamp_ns;
+        have_first = 1;
+    }
+
+    if (mode == MODE_CSV) {
+        printf("%llu,%d,%d,%d,%d,%d\n", (unsigned long long)record->timestamp_ns, record->order_id, record->x, record->y, record->status, record->thread_id);
+    } else if (mode == MODE_TEXT) {
+        double offset = (record->timestamp_ns - first_timestamp) / 1e9;
+        printf("Order %d at (%d, %d): %s by thread %d at +%.6fs\n", record->order_id, record->x, record->y, status_string(record->status), record->thread_id, offset);
+    } else {
+        summarize(record);
+    }
+}
+
+//decode one journal segment, returns -1 if it is not a valid segment
+static int decode_segment(const char *path, OutputMode mode) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    JournalHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0) {
+        printf("%s is not an order journal\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (header.version != JOURNAL_VERSION || header.record_size != sizeof(JournalRecord)) {
+        printf("%s has unsupported version %u\n", path, header.version);
+        fclose(file);
+        return -1;
+    }
+
+    JournalRecord records[1024];
+    uint64_t remaining = header.record_count;
+    while (remaining > 0) {
+        size_t wanted = remaining < 1024 ? remaining : 1024;
+        size_t got = fread(records, sizeof(JournalRecord), wanted, file);
+        for (size_t i = 0; i < got; i++) print_record(&records[i], mode);
+        if (got < wanted) {
+            printf("%s is truncated\n", path);
+            break;
+        }
+        remaining -= got;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static int compare_durations(const void *a, const void *b) {
+    uint64_t first = *(const uint64_t *)a, second = *(const uint64_t *)b;
+    return first < second ? -1 : (first > second);
+}
+
+static void print_summary(void) {
+    printf("%-20s %10s\n", "status", "events");
+    for (int i = 0; i < STATUS_COUNT; i++) printf("%-20s %10llu\n", status_string(i), (unsigned long long)status_counts[i]);
+    if (status_counts[STATUS_COUNT] > 0) printf("%-20s %10llu\n", "Unknown status", (unsigned long long)status_counts[STATUS_COUNT]);
+
+    printf("\n%-28s %8s %10s %10s %10s %10s\n", "stage", "orders", "mean ms", "p50 ms", "p99 ms", "max ms");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        DurationList *list = &stages[i];
+        if (list->count == 0) {
+            printf("%-28s %8d\n", stage_names[i], 0);
+            continue;
+        }
+        qsort(list->values, list->count, sizeof(uint64_t), compare_durations);
+        double sum = 0;
+        for (size_t j = 0; j < list->count; j++) sum += list->values[j];
+        printf("%-28s %8zu %10.3f %10.3f %10.3f %10.3f\n", stage_names[i], list->count, sum / list->count / 1e6, list->values[list->count / 2] / 1e6, list->values[list->count * 99 / 100] / 1e6, list->values[list->count - 1] / 1e6);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    OutputMode mode = MODE_TEXT;
+    int first_file = 1;
+    if (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "--text") == 0) {
+            mode = MODE_TEXT;
+        } else if (strcmp(argv[1], "--csv") == 0) {
+            mode = MODE_CSV;
+        } else if (strcmp(argv[1], "--summary") == 0) {
+            mode = MODE_SUMMARY;
+        } else {
+            first_file = argc; //unknown option, print usage
+        }
+        first_file++;
+    }
+    if (first_file >= argc) {
+        printf("Usage: %s [--text|--csv|--summary] <journal segment>...\n", argv[0]);
+        return 1;
+    }
+
+    if (mode == MODE_CSV) printf("timestamp_ns,order_id,x,y,status,thread_id\n");
+    int failed = 0;
+    for (int i = first_file; i < argc; i++) {
+        if (decode_segment(argv[i], mode) < 0) failed = 1;
+    }
+    if (mode == MODE_SUMMARY) print_summary();
+    return failed;
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <complex.h>
+#include <immintrin.h>
+
+#include "kitchenKernel.h"
+
+//conjugate Gram matrix G[i][j] = sum_k conj(A[i][k]) * A[j][k] on split real/imaginary rows:
+//re = ar_i * ar_j + ai_i * ai_j, im = ar_i * ai_j - ai_i * ar_j.
+//G is Hermitian, so only j >= i is computed and the rest is mirrored as the conjugate.
+
+#define ROW_BLOCK 4 //rows j processed together so row i is loaded once per 4 dot products
+
+typedef void (*GramKernel)(const KernelMatrix *matrix, double *out_re, double *out_im);
+
+static void gram_scalar(const KernelMatrix *matrix, double *out_re, double *out_im);
+static void gram_avx2(const KernelMatrix *matrix, double *out_re, double *out_im);
+static void gram_avx512(const KernelMatrix *matrix, double *out_re, double *out_im);
+
+static GramKernel gram_kernel = gram_scalar;
+static const char *gram_kernel_name = "scalar";
+static _Thread_local uint64_t rng_state[4]; //xoshiro256** state of the calling thread
+static _Thread_local int rng_seeded = 0;
+
+//splitmix64 step, only used to expand the seed
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+//per-thread xoshiro256** generator, needs no lock unlike rand()
+uint64_t kernel_random(void) {
+    if (!rng_seeded) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)(uintptr_t)&rng_state;
+        for (int i = 0; i < 4; i++) rng_state[i] = splitmix64(&seed);
+        rng_seeded = 1;
+    }
+    uint64_t *s = rng_state;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+//fill a matrix with values uniform in [0, 1), the padding columns are zero
+void kernel_fill_random(KernelMatrix *matrix, int rows, int cols) {
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->stride = (cols + KERNEL_LANES - 1) / KERNEL_LANES * KERNEL_LANES;
+    for (int i = 0; i < rows; i++) {
+        double *re = matrix->re + i * matrix->stride;
+        double *im = matrix->im + i * matrix->stride;
+        for (int k = 0; k < cols; k++) {
+            re[k] = (kernel_random() >> 11) * 0x1.0p-53;
+            im[k] = (kernel_random() >> 11) * 0x1.0p-53;
+        }
+        for (int k = cols; k < matrix->stride; k++) {
+            re[k] = 0;
+            im[k] = 0;
+        }
+    }
+}
+
+//store G[i][j] and its mirrored conjugate G[j][i]
+static void store_pair(double *out_re, double *out_im, int n, int i, int j, double re, double im) {
+    out_re[i * n + j] = re;
+    out_im[i * n + j] = im;
+    out_re[j * n + i] = re;
+    out_im[j * n + i] = -im;
+}
+
+static void gram_scalar(const KernelMatrix *matrix, double *out_re, double *out_im) {
+    int n = matrix->rows, stride = matrix->stride;
+    for (int i = 0; i < n; i++) {
+        const double *ar = matrix->re + i * stride, *ai = matrix->im + i * stride;
+        for (int j = i; j < n; j++) {
+            const double *br = matrix->re + j * stride, *bi = matrix->im + j * stride;
+            double re = 0, im = 0;
+            for (int k = 0; k < stride; k++) {
+                re += ar[k] * br[k] + ai[k] * bi[k];
+                im += ar[k] * bi[k] - ai[k] * br[k];
+            }
+            store_pair(out_re, out_im, n, i, j, re, im);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static double hsum256(__m256d v) {
+    __m128d low = _mm256_castpd256_pd128(v);
+    __m128d high = _mm256_extractf128_pd(v, 1);
+    low = _mm_add_pd(low, high);
+    return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+}
+
+__attribute__((target("avx2,fma")))
+static void gram_avx2(const KernelMatrix *matrix, double *out_re, double *out_im) {
+    int n = matrix->rows, stride = matrix->stride;
+    for (int i = 0; i < n; i++) {
+        const double *ar = matrix->re + i * stride, *ai = matrix->im + i * stride;
+        int j = i;
+        //register block: row i against ROW_BLOCK rows j at a time
+        for (; j + ROW_BLOCK <= n; j += ROW_BLOCK) {
+            __m256d acc_re[ROW_BLOCK], acc_im[ROW_BLOCK];
+            for (int b = 0; b < ROW_BLOCK; b++) {
+                acc_re[b] = _mm256_setzero_pd();
+                acc_im[b] = _mm256_setzero_pd();
+            }
+            for (int k = 0; k < stride; k += 4) {
+                __m256d xr = _mm256_load_pd(ar + k), xi = _mm256_load_pd(ai + k);
+                for (int b = 0; b < ROW_BLOCK; b++) {
+                    __m256d yr = _mm256_load_pd(matrix->re + (j + b) * stride + k);
+                    __m256d yi = _mm256_load_pd(matrix->im + (j + b) * stride + k);
+                    acc_re[b] = _mm256_fmadd_pd(xr, yr, _mm256_fmadd_pd(xi, yi, acc_re[b]));
+                    acc_im[b] = _mm256_fmadd_pd(xr, yi, _mm256_fnmadd_pd(xi, yr, acc_im[b]));
+                }
+            }
+            for (int b = 0; b < ROW_BLOCK; b++) store_pair(out_re, out_im, n, i, j + b, hsum256(acc_re[b]), hsum256(acc_im[b]));
+        }
+        for (; j < n; j++) {
+            const double *br = matrix->re + j * stride, *bi = matrix->im + j * stride;
+            __m256d acc_re = _mm256_setzero_pd(), acc_im = _mm256_setzero_pd();
+            for (int k = 0; k < stride; k += 4) {
+                __m256d xr = _mm256_load_pd(ar + k), xi = _mm256_load_pd(ai + k);
+                __m256d yr = _mm256_load_pd(br + k), yi = _mm256_load_pd(bi + k);
+                acc_re = _mm256_fmadd_pd(xr, yr, _mm256_fmadd_pd(xi, yi, acc_re));
+                acc_im = _mm256_fmadd_pd(xr, yi, _mm256_fnmadd_pd(xi, yr, acc_im));
+            }
+            store_pair(out_re, out_im, n, i, j, hsum256(acc_re), hsum256(acc_im));
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gram_avx512(const KernelMatrix *matrix, double *out_re, double *out_im) {
+    int n = matrix->rows, stride = matrix->stride;
+    for (int i = 0; i < n; i++) {
+        const double *ar = matrix->re + i * stride, *ai = matrix->im + i * stride;
+        int j = i;
+        for (; j + ROW_BLOCK <= n; j += ROW_BLOCK) {
+            __m512d acc_re[ROW_BLOCK], acc_im[ROW_BLOCK];
+            for (int b = 0; b < ROW_BLOCK; b++) {
+                acc_re[b] = _mm512_setzero_pd();
+                acc_im[b] = _mm512_setzero_pd();
+            }
+            for (int k = 0; k < stride; k += 8) {
+                __m512d xr = _mm512_load_pd(ar + k), xi = _mm512_load_pd(ai + k);
+                for (int b = 0; b < ROW_BLOCK; b++) {
+                    __m512d yr = _mm512_load_pd(matrix->re + (j + b) * stride + k);
+                    __m512d yi = _mm512_load_pd(matrix->im + (j + b) * stride + k);
+                    acc_re[b] = _mm512_fmadd_pd(xr, yr, _mm512_fmadd_pd(xi, yi, acc_re[b]));
+                    acc_im[b] = _mm512_fmadd_pd(xr, yi, _mm512_fnmadd_pd(xi, yr, acc_im[b]));
+                }
+            }
+            for (int b = 0; b < ROW_BLOCK; b++) store_pair(out_re, out_im, n, i, j + b, _mm512_reduce_add_pd(acc_re[b]), _mm512_reduce_add_pd(acc_im[b]));
+        }
+        for (; j < n; j++) {
+            const double *br = matrix->re + j * stride, *bi = matrix->im + j * stride;
+            __m512d acc_re = _mm512_setzero_pd(), acc_im = _mm512_setzero_pd();
+            for (int k = 0; k < stride; k += 8) {
+                __m512d xr = _mm512_load_pd(ar + k), xi = _mm512_load_pd(ai + k);
+                __m512d yr = _mm512_load_pd(br + k), yi = _mm512_load_pd(bi + k);
+                acc_re = _mm512_fmadd_pd(xr, yr, _mm512_fmadd_pd(xi, yi, acc_re));
+                acc_im = _mm512_fmadd_pd(xr, yi, _mm512_fnmadd_pd(xi, yr, acc_im));
+            }
+            store_pair(out_re, out_im, n, i, j, _mm512_reduce_add_pd(acc_re), _mm512_reduce_add_pd(acc_im));
+        }
+    }
+}
+
+//the original complex triple loop, kept to validate the fast kernels
+void kernel_gram_reference(const KernelMatrix *matrix, double *out_re, double *out_im) {
+    int n = matrix->rows, m = matrix->cols, stride = matrix->stride;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            double complex result = 0;
+            for (int k = 0; k < m; k++) {
+                double complex a = matrix->re[i * stride + k] + I * matrix->im[i * stride + k];
+                double complex b = matrix->re[j * stride + k] + I * matrix->im[j * stride + k];
+                result += conj(a) * b;
+            }
+            out_re[i * n + j] = creal(result);
+            out_im[i * n + j] = cimag(result);
+        }
+    }
+}
+
+//run the selected kernel
+void kernel_gram(const KernelMatrix *matrix, double *out_re, double *out_im) {
+    gram_kernel(matrix, out_re, out_im);
+}
+
+//pick an implementation, KERNEL_AUTO takes the widest one the CPU supports; returns -1 if unsupported
+int kernel_select(KernelType type) {
+    __builtin_cpu_init();
+    int has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    int has_avx512 = __builtin_cpu_supports("avx512f");
+
+    if (type == KERNEL_AUTO) type = has_avx512 ? KERNEL_AVX512 : has_avx2 ? KERNEL_AVX2 : KERNEL_SCALAR;
+    switch (type) {
+        case KERNEL_AVX512:
+            if (!has_avx512) return -1;
+            gram_kernel = gram_avx512;
+            gram_kernel_name = "avx512";
+            break;
+        case KERNEL_AVX2:
+            if (!has_avx2) return -1;
+            gram_kernel = gram_avx2;
+            gram_kernel_name = "avx2";
+            break;
+        default:
+            gram_kernel = gram_scalar;
+            gram_kernel_name = "scalar";
+            break;
+    }
+    return 0;
+}
+
+const char *kernel_name(void) {
+    return gram_kernel_name;
+}
+
+//translate a command line name into a kernel type, returns -1 for unknown names
+int kernel_parse_type(const char *name, KernelType *type) {
+    if (strcmp(name, "auto") == 0) *type = KERNEL_AUTO;
+    else if (strcmp(name, "scalar") == 0) *type = KERNEL_SCALAR;
+    else if (strcmp(name, "avx2") == 0) *type = KERNEL_AVX2;
+    else if (strcmp(name, "avx512") == 0) *type = KERNEL_AVX512;
+    else return -1;
+    return 0;
+}
+
+//compare the selected kernel with the reference loop on random input, returns -1 on mismatch
+int kernel_self_check(void) {
+    static KernelMatrix matrix;
+    double fast_re[KERNEL_MAX_ROWS * KERNEL_MAX_ROWS], fast_im[KERNEL_MAX_ROWS * KERNEL_MAX_ROWS];
+    double ref_re[KERNEL_MAX_ROWS * KERNEL_MAX_ROWS], ref_im[KERNEL_MAX_ROWS * KERNEL_MAX_ROWS];
+    int shapes[][2] = {{30, 40}, {15, 40}, {7, 13}, {1, 1}};
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        int n = shapes[s][0];
+        kernel_fill_random(&matrix, n, shapes[s][1]);
+        kernel_gram(&matrix, fast_re, fast_im);
+        kernel_gram_reference(&matrix, ref_re, ref_im);
+        for (int i = 0; i < n * n; i++) {
+            double scale = fabs(ref_re[i]) + fabs(ref_im[i]) + 1.0;
+            if (fabs(fast_re[i] - ref_re[i]) > 1e-12 * scale || fabs(fast_im[i] - ref_im[i]) > 1e-12 * scale) return -1;
+        }
+    }
+    return 0;
+}
+
+//fill a rows x cols matrix and compute its Gram matrix, the CPU work behind prep and cook
+void kernel_simulate(int rows, int cols) {
+    static _Thread_local KernelMatrix matrix;
+    static _Thread_local double result_re[KERNEL_MAX_ROWS * KERNEL_MAX_ROWS];
+    static _Thread_local double result_im[KERNEL_MAX_ROWS * KERNEL_MAX_ROWS];
+    kernel_fill_random(&matrix, rows, cols);
+    kernel_gram(&matrix, result_re, result_im);
+}
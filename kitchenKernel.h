@@ -0,0 +1,35 @@
+#ifndef KITCHEN_KERNEL_H
+#define KITCHEN_KERNEL_H
+
+#include <stdint.h>
+
+#define KERNEL_MAX_ROWS 32 //largest n the simulation kernels use
+#define KERNEL_MAX_COLS 48 //largest m the simulation kernels use
+#define KERNEL_LANES 8 //rows are padded to a multiple of this many doubles
+
+//implementations of the conjugate Gram kernel
+typedef enum {
+    KERNEL_AUTO,
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+} KernelType;
+
+//split real/imaginary matrix, row i starts at i * stride
+typedef struct {
+    _Alignas(64) double re[KERNEL_MAX_ROWS * KERNEL_MAX_COLS];
+    _Alignas(64) double im[KERNEL_MAX_ROWS * KERNEL_MAX_COLS];
+    int rows, cols, stride;
+} KernelMatrix;
+
+int kernel_select(KernelType type);
+const char *kernel_name(void);
+int kernel_parse_type(const char *name, KernelType *type);
+void kernel_fill_random(KernelMatrix *matrix, int rows, int cols);
+void kernel_gram(const KernelMatrix *matrix, double *out_re, double *out_im);
+void kernel_gram_reference(const KernelMatrix *matrix, double *out_re, double *out_im);
+int kernel_self_check(void);
+void kernel_simulate(int rows, int cols);
+uint64_t kernel_random(void);
+
+#endif
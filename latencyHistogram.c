@@ -0,0 +1,77 @@
+#include "latencyHistogram.h"
+
+//values below HISTOGRAM_SUB_BUCKETS are exact, above that each power of two is split into HISTOGRAM_SUB_BUCKETS
+static int bucket_of(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) return (int)value;
+    int exponent = 63 - __builtin_clzll(value) - 4;
+    return HISTOGRAM_SUB_BUCKETS + exponent * HISTOGRAM_SUB_BUCKETS + (int)((value >> exponent) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+//largest value that falls into a bucket
+static uint64_t bucket_limit(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+    int exponent = (bucket - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS;
+    uint64_t sub = (bucket - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << exponent) - 1;
+}
+
+void histogram_init(LatencyHistogram *histogram) {
+    atomic_init(&histogram->count, 0);
+    atomic_init(&histogram->sum, 0);
+    atomic_init(&histogram->max, 0);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) atomic_init(&histogram->counts[i], 0);
+}
+
+//record one value, must only be called by the thread that owns the histogram
+void histogram_record(LatencyHistogram *histogram, uint64_t value) {
+    add_relaxed(&histogram->counts[bucket_of(value)], 1);
+    add_relaxed(&histogram->count, 1);
+    add_relaxed(&histogram->sum, value);
+    if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed)) atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+}
+
+//add the values of one histogram to another, into must not be shared with other writers
+void histogram_merge(LatencyHistogram *into, LatencyHistogram *from) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        uint64_t count = atomic_load_explicit(&from->counts[i], memory_order_relaxed);
+        if (count > 0) add_relaxed(&into->counts[i], count);
+    }
+    add_relaxed(&into->count, atomic_load_explicit(&from->count, memory_order_relaxed));
+    add_relaxed(&into->sum, atomic_load_explicit(&from->sum, memory_order_relaxed));
+    uint64_t max = atomic_load_explicit(&from->max, memory_order_relaxed);
+    if (max > atomic_load_explicit(&into->max, memory_order_relaxed)) atomic_store_explicit(&into->max, max, memory_order_relaxed);
+}
+
+//value below which the given percentile (0-100) of the recorded values fall
+uint64_t histogram_percentile(LatencyHistogram *histogram, double percentile) {
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t limit = bucket_limit(i);
+            uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+            return limit < max ? limit : max;
+        }
+    }
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+//number of recorded values whose bucket lies entirely at or below value
+uint64_t histogram_count_at_most(LatencyHistogram *histogram, uint64_t value) {
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS && bucket_limit(i) <= value; i++) {
+        count += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    return count;
+}
+
+double histogram_mean(LatencyHistogram *histogram) {
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    return count ? (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed) / count : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "stageQueue.h"
+
+#define HISTOGRAM_SUB_BUCKETS 16 //linear buckets per power of two, about 6% precision
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+//log-linear histogram of nanosecond values, written by one thread and readable by others at any time
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t counts[HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+void histogram_init(LatencyHistogram *histogram);
+void histogram_record(LatencyHistogram *histogram, uint64_t value);
+void histogram_merge(LatencyHistogram *into, LatencyHistogram *from);
+uint64_t histogram_percentile(LatencyHistogram *histogram, double percentile);
+uint64_t histogram_count_at_most(LatencyHistogram *histogram, uint64_t value);
+double histogram_mean(LatencyHistogram *histogram);
+
+#endif
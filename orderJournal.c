@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "orderJournal.h"
+
+//create, pre-allocate and map the segment with the current index
+static int map_segment(Journal *journal) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s.%04u", journal->prefix, journal->segment_index);
+
+    journal->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (journal->fd < 0) return -1;
+    if (posix_fallocate(journal->fd, 0, journal->segment_bytes) != 0) {
+        close(journal->fd);
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, journal->segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(journal->fd);
+        return -1;
+    }
+
+    journal->header = mapping;
+    journal->records = (JournalRecord *)(journal->header + 1);
+    memcpy(journal->header->magic, JOURNAL_MAGIC, sizeof(journal->header->magic));
+    journal->header->version = JOURNAL_VERSION;
+    journal->header->record_size = sizeof(JournalRecord);
+    journal->header->segment_index = journal->segment_index;
+    journal->header->capacity = (journal->segment_bytes - sizeof(JournalHeader)) / sizeof(JournalRecord);
+    journal->header->record_count = 0;
+    return 0;
+}
+
+//unmap the current segment and cut the unused tail off the file
+static void unmap_segment(Journal *journal) {
+    off_t used = sizeof(JournalHeader) + journal->header->record_count * sizeof(JournalRecord);
+    msync(journal->header, journal->segment_bytes, MS_SYNC);
+    munmap(journal->header, journal->segment_bytes);
+    if (ftruncate(journal->fd, used) < 0) perror("Failed to trim journal segment");
+    close(journal->fd);
+    journal->header = NULL;
+}
+
+//start a journal whose first segment is <prefix>.0000
+int journal_open(Journal *journal, const char *prefix, size_t segment_bytes) {
+    if (segment_bytes < sizeof(JournalHeader) + sizeof(JournalRecord)) return -1;
+    snprintf(journal->prefix, sizeof(journal->prefix), "%s", prefix);
+    journal->segment_bytes = segment_bytes;
+    journal->segment_index = 0;
+    return map_segment(journal);
+}
+
+//append one event, moving to a new segment when the current one is full
+int journal_append(Journal *journal, const LogEvent *event) {
+    if (journal->header == NULL) return -1; //a previous rotation failed
+    if (journal->header->record_count == journal->header->capacity) {
+        unmap_segment(journal);
+        journal->segment_index++;
+        if (map_segment(journal) < 0) return -1;
+    }
+
+    JournalRecord *record = &journal->records[journal->header->record_count];
+    record->timestamp_ns = event->timestamp_ns;
+    record->order_id = event->order_id;
+    record->x = event->x;
+    record->y = event->y;
+    record->thread_id = event->thread_id;
+    record->status = event->status;
+    record->reserved = 0;
+    journal->header->record_count++; //the count only covers fully written records
+    return 0;
+}
+
+//flush and close the last segment
+void journal_close(Journal *journal) {
+    if (journal->header != NULL) unmap_segment(journal);
+}
@@ -0,0 +1,49 @@
+#ifndef ORDER_JOURNAL_H
+#define ORDER_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "orderLog.h"
+
+#define JOURNAL_MAGIC "PIDEJRNL"
+#define JOURNAL_VERSION 1
+#define DEFAULT_JOURNAL_SEGMENT_MB 64 //size of one pre-allocated journal segment
+
+//header at the start of every journal segment
+typedef struct {
+    char magic[8]; //JOURNAL_MAGIC without the terminating zero
+    uint32_t version; //JOURNAL_VERSION
+    uint32_t record_size; //sizeof(JournalRecord)
+    uint32_t segment_index; //position of the segment in the journal
+    uint32_t reserved;
+    uint64_t capacity; //records that fit into the segment
+    uint64_t record_count; //records written so far
+    uint64_t padding[3];
+} JournalHeader;
+
+//fixed width record for one status change
+typedef struct {
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC time of the event
+    int32_t order_id;
+    int32_t x, y; //coordinates of the delivery address
+    int32_t thread_id; //worker that changed the status, -1 for the manager
+    int32_t status; //new status of the order
+    int32_t reserved;
+} JournalRecord;
+
+//journal being written, one memory mapped segment at a time
+typedef struct {
+    char prefix[256]; //segments are named <prefix>.<index>
+    size_t segment_bytes; //pre-allocated size of each segment
+    uint32_t segment_index; //index of the mapped segment
+    int fd; //descriptor of the mapped segment
+    JournalHeader *header; //start of the mapping
+    JournalRecord *records; //records follow the header
+} Journal;
+
+int journal_open(Journal *journal, const char *prefix, size_t segment_bytes);
+int journal_append(Journal *journal, const LogEvent *event);
+void journal_close(Journal *journal);
+
+#endif
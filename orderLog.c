@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "orderLog.h"
+#include "stageQueue.h"
+#include "orderJournal.h"
+
+#define LOG_RING_SIZE 512 //events buffered per thread, power of two
+#define MAX_LOG_RINGS 4096 //maximum number of threads that may log at once
+#define LOG_BATCH_SIZE 8192 //events formatted per write
+#define LOG_LINE_SIZE 192 //upper bound of one formatted event
+
+//single producer single consumer ring owned by one worker thread
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail; //next slot the owner writes
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head; //next slot the writer reads
+    atomic_int in_use; //cleared when the owning thread exits so the ring can be reused
+    LogEvent events[LOG_RING_SIZE];
+} LogRing;
+
+static FILE *log_file; //log file to record order status
+static int journal_mode = 0; //write binary journal records instead of text
+static Journal journal; //binary journal, only used in journal mode
+static int flush_interval_ms; //time between two batches of the writer thread
+static uint64_t log_start_ns; //events are stamped relative to this
+static pthread_t writer_thread;
+static _Atomic(LogRing *) rings[MAX_LOG_RINGS]; //rings of all threads that ever logged
+static atomic_int ring_count = 0;
+static atomic_int stopping = 0;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER; //only taken to sleep or wake the writer
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t register_mutex = PTHREAD_MUTEX_INITIALIZER; //taken once per thread to get a ring
+static pthread_key_t ring_key;
+static _Thread_local LogRing *thread_ring;
+static LogEvent batch[LOG_BATCH_SIZE];
+static LogEvent *sorted[LOG_BATCH_SIZE];
+
+static void *writer_routine(void *arg);
+
+//current CLOCK_MONOTONIC time in nanoseconds
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//called when a logging thread exits, the writer still drains what is left in its ring
+static void release_ring(void *ring) {
+    atomic_store(&((LogRing *)ring)->in_use, 0);
+}
+
+//start the writer thread once the output is ready
+static int start_writer(int flush_ms) {
+    flush_interval_ms = flush_ms > 0 ? flush_ms : DEFAULT_LOG_FLUSH_MS;
+    log_start_ns = monotonic_ns();
+    pthread_key_create(&ring_key, release_ring);
+    return pthread_create(&writer_thread, NULL, writer_routine, NULL) == 0 ? 0 : -1;
+}
+
+//open the text log file and start the writer thread
+int order_log_open(const char *path, int flush_ms) {
+    log_file = fopen(path, "w");
+    if (log_file == NULL) return -1;
+    if (start_writer(flush_ms) < 0) {
+        fclose(log_file);
+        return -1;
+    }
+    return 0;
+}
+
+//open a binary journal made of segments of segment_bytes and start the writer thread
+int order_log_open_journal(const char *prefix, size_t segment_bytes, int flush_ms) {
+    if (journal_open(&journal, prefix, segment_bytes) < 0) return -1;
+    journal_mode = 1;
+    if (start_writer(flush_ms) < 0) {
+        journal_close(&journal);
+        return -1;
+    }
+    return 0;
+}
+
+//give the calling thread a ring, reusing one left behind by an exited thread
+static LogRing *register_thread(void) {
+    LogRing *ring = NULL;
+    pthread_mutex_lock(&register_mutex);
+    int count = atomic_load(&ring_count);
+    for (int i = 0; i < count && ring == NULL; i++) {
+        LogRing *candidate = atomic_load(&rings[i]);
+        if (!atomic_load(&candidate->in_use) && atomic_load(&candidate->head) == atomic_load(&candidate->tail)) {
+            ring = candidate;
+        }
+    }
+    if (ring == NULL && count < MAX_LOG_RINGS) {
+        ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(LogRing));
+        if (ring != NULL) {
+            atomic_init(&ring->tail, 0);
+            atomic_init(&ring->head, 0);
+            atomic_store(&rings[count], ring);
+            atomic_store(&ring_count, count + 1);
+        }
+    }
+    if (ring != NULL) atomic_store(&ring->in_use, 1);
+    pthread_mutex_unlock(&register_mutex);
+
+    if (ring != NULL) pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static void wake_writer(void) {
+    pthread_mutex_lock(&writer_mutex);
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+}
+
+//record a status change, never blocks on I/O
+void order_log_event(int order_id, int x, int y, int status, int thread_id, time_t order_time) {
+    if (thread_ring == NULL) {
+        thread_ring = register_thread();
+        if (thread_ring == NULL) {
+            printf("Too many logging threads, event for order %d dropped\n", order_id);
+            return;
+        }
+    }
+
+    LogRing *ring = thread_ring;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    //a full ring means the writer fell behind, wait for it instead of losing the event
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= LOG_RING_SIZE) {
+        wake_writer();
+        sched_yield();
+    }
+
+    LogEvent *event = &ring->events[tail & (LOG_RING_SIZE - 1)];
+    event->timestamp_ns = monotonic_ns();
+    event->order_time = order_time;
+    event->order_id = order_id;
+    event->x = x;
+    event->y = y;
+    event->status = status;
+    event->thread_id = thread_id;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+//copy pending events of all rings into the batch, returns how many were taken
+static int collect_batch(void) {
+    int taken = 0;
+    int count = atomic_load(&ring_count);
+    for (int i = 0; i < count && taken < LOG_BATCH_SIZE; i++) {
+        LogRing *ring = atomic_load(&rings[i]);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        while (head != tail && taken < LOG_BATCH_SIZE) {
+            batch[taken++] = ring->events[head & (LOG_RING_SIZE - 1)];
+            head++;
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    return taken;
+}
+
+//order events by time, events of the same ring keep their batch order
+static int compare_events(const void *a, const void *b) {
+    const LogEvent *first = *(LogEvent *const *)a;
+    const LogEvent *second = *(LogEvent *const *)b;
+    if (first->timestamp_ns != second->timestamp_ns) return first->timestamp_ns < second->timestamp_ns ? -1 : 1;
+    return first < second ? -1 : (first > second);
+}
+
+static const char *status_string(int status) {
+    switch (status) {
+        case 0:
+            return "Order received";
+        case 1:
+            return "Preparing";
+        case 2:
+            return "Cooking";
+        case 3:
+            return "Ready for delivery";
+        case 4:
+            return "Out for delivery";
+        case 5:
+            return "Delivered";
+        case 6:
+            return "Canceled";
+        default:
+            return "Unknown status";
+    }
+}
+
+//write the batch as journal records, or format it as text and write it with a single flush
+static void write_batch(int count) {
+    static char buffer[LOG_BATCH_SIZE * LOG_LINE_SIZE];
+    static time_t cached_time = -1;
+    static char cached_time_str[32];
+    size_t used = 0;
+
+    for (int i = 0; i < count; i++) sorted[i] = &batch[i];
+    qsort(sorted, count, sizeof(LogEvent *), compare_events);
+
+    if (journal_mode) {
+        for (int i = 0; i < count; i++) {
+            if (journal_append(&journal, sorted[i]) < 0) {
+                printf("Failed to append to the order journal\n");
+                return;
+            }
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        LogEvent *event = sorted[i];
+        if (event->order_time != cached_time) {
+            ctime_r(&event->order_time, cached_time_str);
+            cached_time = event->order_time;
+        }
+        if (event->status == 2 || event->status == 3) {
+            used += snprintf(buffer + used, sizeof(buffer) - used, "Order for client %d is get order into aparatus\n", event->order_id);
+        }
+        double offset = event->timestamp_ns > log_start_ns ? (event->timestamp_ns - log_start_ns) / 1e9 : 0; //when it happened, not when the order was placed
+        used += snprintf(buffer + used, sizeof(buffer) - used, "Order %d at (%d, %d): %s by thread %d at +%.6fs, ordered %s", event->order_id, event->x, event->y, status_string(event->status), event->thread_id, offset, cached_time_str);
+    }
+
+    fwrite(buffer, 1, used, log_file);
+    fflush(log_file);
+}
+
+//drain all rings every flush interval, or sooner when a producer ring is full
+static void *writer_routine(void *arg) {
+    (void)arg;
+    while (1) {
+        int stop = atomic_load(&stopping);
+        int count;
+        while ((count = collect_batch()) > 0) write_batch(count);
+        if (stop) return NULL; //rings were drained after the stop request was seen
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += flush_interval_ms / 1000;
+        deadline.tv_nsec += (long)(flush_interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&writer_mutex);
+        if (!atomic_load(&stopping)) pthread_cond_timedwait(&writer_cond, &writer_mutex, &deadline);
+        pthread_mutex_unlock(&writer_mutex);
+    }
+}
+
+//stop the writer after it has written every buffered event and close the log file
+void order_log_close(void) {
+    pthread_mutex_lock(&writer_mutex);
+    atomic_store(&stopping, 1);
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer_thread, NULL);
+    if (journal_mode) {
+        journal_close(&journal);
+    } else {
+        fclose(log_file);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef ORDER_LOG_H
+#define ORDER_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define DEFAULT_LOG_FLUSH_MS 100 //how often the writer thread flushes buffered events
+
+//fixed size record pushed by worker threads for every status change
+typedef struct {
+    uint64_t timestamp_ns; //CLOCK_MONOTONIC time the event happened
+    time_t order_time; //time the order was placed
+    int order_id;
+    int x, y; //coordinates of the delivery address
+    int status; //new status of the order
+    int thread_id; //worker that changed the status, -1 for the manager
+} LogEvent;
+
+int order_log_open(const char *path, int flush_interval_ms);
+int order_log_open_journal(const char *prefix, size_t segment_bytes, int flush_interval_ms);
+void order_log_event(int order_id, int x, int y, int status, int thread_id, time_t order_time);
+void order_log_close(void);
+uint64_t monotonic_ns(void);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "orderSlab.h"
+
+#define SLAB_NO_SLOT UINT32_MAX
+
+//slot header of an index, the chunk table only grows so the address is stable
+static SlabSlot *slab_slot(Slab *slab, uint32_t index) {
+    unsigned char *chunk = slab->chunks[index / SLAB_CHUNK_ITEMS];
+    return (SlabSlot *)(chunk + (size_t)(index % SLAB_CHUNK_ITEMS) * slab->stride);
+}
+
+//add a chunk of free slots, slab->mutex must be held
+static int slab_grow(Slab *slab) {
+    if (slab->chunk_count == SLAB_MAX_CHUNKS || slab_capacity(slab) >= slab->max_items) return -1;
+
+    unsigned char *chunk = aligned_alloc(SLAB_SLOT_ALIGN, SLAB_CHUNK_ITEMS * slab->stride);
+    if (chunk == NULL) return -1;
+    memset(chunk, 0, SLAB_CHUNK_ITEMS * slab->stride);
+
+    uint32_t first = slab->chunk_count * SLAB_CHUNK_ITEMS;
+    slab->chunks[slab->chunk_count] = chunk;
+    atomic_store_explicit(&slab->chunk_count, slab->chunk_count + 1, memory_order_release); //publish the chunk
+
+    //push the new slots so the lowest index is handed out first
+    for (uint32_t i = SLAB_CHUNK_ITEMS; i-- > 0;) {
+        SlabSlot *slot = slab_slot(slab, first + i);
+        atomic_init(&slot->generation, 0);
+        slot->index = first + i;
+        slot->next_free = slab->free_head;
+        slab->free_head = first + i;
+    }
+    return 0;
+}
+
+//initialize a slab of items of item_size bytes with room for initial_items, growing in chunks up to max_items
+int slab_init(Slab *slab, size_t item_size, uint32_t initial_items, uint32_t max_items) {
+    memset(slab, 0, sizeof(*slab));
+    slab->stride = (sizeof(SlabSlot) + item_size + SLAB_SLOT_ALIGN - 1) & ~(size_t)(SLAB_SLOT_ALIGN - 1);
+    slab->max_items = max_items;
+    slab->free_head = SLAB_NO_SLOT;
+    pthread_mutex_init(&slab->mutex, NULL);
+
+    //chunks are allocated up front so the hot path only pops the free list
+    while (slab_capacity(slab) < initial_items) {
+        if (slab_grow(slab) < 0) return -1;
+    }
+    return 0;
+}
+
+//release every chunk, outstanding items become invalid
+void slab_destroy(Slab *slab) {
+    for (uint32_t i = 0; i < slab->chunk_count; i++) free(slab->chunks[i]);
+    slab->chunk_count = 0;
+    slab->free_head = SLAB_NO_SLOT;
+    pthread_mutex_destroy(&slab->mutex);
+}
+
+//take a zeroed item from the free list, growing by a chunk if it is empty. Returns NULL when the slab is full
+void *slab_alloc(Slab *slab, SlabHandle *handle) {
+    pthread_mutex_lock(&slab->mutex);
+    if (slab->live >= slab->max_items || (slab->free_head == SLAB_NO_SLOT && slab_grow(slab) < 0)) {
+        pthread_mutex_unlock(&slab->mutex);
+        return NULL;
+    }
+    SlabSlot *slot = slab_slot(slab, slab->free_head);
+    slab->free_head = slot->next_free;
+    slab->live++;
+    pthread_mutex_unlock(&slab->mutex);
+
+    void *item = slot + 1;
+    memset(item, 0, slab->stride - sizeof(SlabSlot));
+    uint32_t generation = (atomic_load_explicit(&slot->generation, memory_order_relaxed) + 1) & SLAB_GENERATION_MASK;
+    atomic_store_explicit(&slot->generation, generation, memory_order_release); //odd, the slot is live
+    if (handle != NULL) *handle = ((SlabHandle)generation << 32) | slot->index;
+    return item;
+}
+
+//return an item to the free list, handles to it stop resolving
+void slab_free(Slab *slab, void *item) {
+    SlabSlot *slot = (SlabSlot *)item - 1;
+    uint32_t generation = (atomic_load_explicit(&slot->generation, memory_order_relaxed) + 1) & SLAB_GENERATION_MASK;
+    atomic_store_explicit(&slot->generation, generation, memory_order_release); //even, the slot is free
+
+    pthread_mutex_lock(&slab->mutex);
+    slot->next_free = slab->free_head;
+    slab->free_head = slot->index;
+    slab->live--;
+    pthread_mutex_unlock(&slab->mutex);
+}
+
+//handle of a live item
+SlabHandle slab_handle(Slab *slab, void *item) {
+    (void)slab;
+    SlabSlot *slot = (SlabSlot *)item - 1;
+    return ((SlabHandle)atomic_load_explicit(&slot->generation, memory_order_acquire) << 32) | slot->index;
+}
+
+//item of a handle, or NULL if the handle is stale because the slot was freed or reused
+void *slab_get(Slab *slab, SlabHandle handle) {
+    uint32_t index = (uint32_t)handle;
+    uint32_t generation = (uint32_t)(handle >> 32);
+    if ((generation & 1) == 0) return NULL;
+    if (index / SLAB_CHUNK_ITEMS >= atomic_load_explicit(&slab->chunk_count, memory_order_acquire)) return NULL;
+
+    SlabSlot *slot = slab_slot(slab, index);
+    if (atomic_load_explicit(&slot->generation, memory_order_acquire) != generation) return NULL;
+    return slot + 1;
+}
+
+//live item at a slot index for walking the slab, NULL if the slot is free
+void *slab_at(Slab *slab, uint32_t index) {
+    if (index >= slab_capacity(slab)) return NULL;
+    SlabSlot *slot = slab_slot(slab, index);
+    if ((atomic_load_explicit(&slot->generation, memory_order_acquire) & 1) == 0) return NULL;
+    return slot + 1;
+}
+
+//number of slots the slab holds right now
+uint32_t slab_capacity(Slab *slab) {
+    return slab->chunk_count * SLAB_CHUNK_ITEMS;
+}
+
+//number of slots in use
+uint32_t slab_live(Slab *slab) {
+    return slab->live;
+}
@@ -0,0 +1,46 @@
+#ifndef ORDER_SLAB_H
+#define ORDER_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define SLAB_CHUNK_ITEMS 1024 //slots added when the slab grows
+#define SLAB_MAX_CHUNKS 4096 //chunk table size, the slab never holds more than this many chunks
+#define SLAB_SLOT_ALIGN 64 //slots start on a cache line, the header shares it with the first bytes of the item
+#define SLAB_GENERATION_MASK 0x3fffffffu //generations wrap in 30 bits so the top two bits of a handle are always clear
+
+//generation in the high 32 bits and slot index in the low 32 bits, 0 is never a valid handle
+typedef uint64_t SlabHandle;
+
+//header in front of every item, a slot is live while its generation is odd
+typedef struct {
+    _Atomic uint32_t generation;
+    uint32_t index; //position of the slot in the slab
+    uint32_t next_free; //next slot of the free list
+    uint32_t pad;
+} SlabSlot;
+
+//pool of fixed-size items in chunks that never move, freed slots are reused
+typedef struct {
+    unsigned char *chunks[SLAB_MAX_CHUNKS];
+    size_t stride; //header plus item, rounded to SLAB_SLOT_ALIGN
+    _Atomic uint32_t chunk_count; //read without the mutex when resolving handles
+    uint32_t max_items; //the slab does not grow past this many slots
+    uint32_t free_head; //first free slot, UINT32_MAX if none
+    uint32_t live; //slots in use
+    pthread_mutex_t mutex; //protects the free list and growth
+} Slab;
+
+int slab_init(Slab *slab, size_t item_size, uint32_t initial_items, uint32_t max_items);
+void slab_destroy(Slab *slab);
+void *slab_alloc(Slab *slab, SlabHandle *handle);
+void slab_free(Slab *slab, void *item);
+SlabHandle slab_handle(Slab *slab, void *item);
+void *slab_get(Slab *slab, SlabHandle handle);
+void *slab_at(Slab *slab, uint32_t index);
+uint32_t slab_capacity(Slab *slab);
+uint32_t slab_live(Slab *slab);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "orderTrace.h"
+#include "orderLog.h"
+
+//span of a finished order, copied out of its slot before the slot is recycled
+typedef struct {
+    OrderSpan span;
+    int order_id;
+    int x, y; //coordinates of the delivery address
+    int status; //final status of the order
+    atomic_int ready; //set once the copy is complete
+} TraceRecord;
+
+//interval between two boundaries, drawn on the track of the order and on the lane of the worker if it has one
+typedef struct {
+    const char *name;
+    SpanPoint from, to;
+    int worker_pid; //process of the worker lanes in the trace, 0 for time spent waiting
+} TracePhase;
+
+static const TracePhase phases[] = {
+    {"prep queue", SPAN_RECEIVED, SPAN_PREP_START, 0},
+    {"prepare", SPAN_PREP_START, SPAN_PREP_END, 2},
+    {"cook queue", SPAN_PREP_END, SPAN_OVEN_TAKEN, 0},
+    {"oven wait", SPAN_OVEN_TAKEN, SPAN_COOK_START, 0},
+    {"cook", SPAN_COOK_START, SPAN_READY, 3},
+    {"bag wait", SPAN_READY, SPAN_OUT, 0},
+    {"travel", SPAN_OUT, SPAN_DELIVERED, 4},
+};
+static const char *process_names[] = {NULL, "orders", "cooks", "ovens", "couriers"};
+static const char *status_names[] = {"Received", "Preparing", "Cooking", "Ready", "Out for delivery", "Delivered", "Canceled"};
+
+static char *trace_path; //file written by trace_close, NULL when tracing is off
+static TraceRecord *records;
+static int record_capacity;
+static atomic_int record_count = 0; //slots handed out, may exceed record_capacity
+static atomic_int enabled = 0;
+static uint64_t start_ns; //time zero of the trace
+
+//keep the spans of up to max_orders finished orders and write them to path on trace_close
+int trace_open(const char *path, int max_orders) {
+    records = calloc(max_orders, sizeof(TraceRecord));
+    if (records == NULL) return -1;
+    trace_path = (char *)path;
+    record_capacity = max_orders;
+    start_ns = monotonic_ns();
+    atomic_store(&enabled, 1);
+    return 0;
+}
+
+//stamp a stage boundary of an order, a no-op unless tracing is on
+void trace_mark(OrderSpan *span, SpanPoint point, int thread_id) {
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+    span->ns[point] = monotonic_ns();
+    span->thread_ids[point] = thread_id;
+}
+
+//keep the span of an order that was delivered or canceled, without taking a lock
+void trace_order(const OrderSpan *span, int order_id, int x, int y, int status) {
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+    int slot = atomic_fetch_add_explicit(&record_count, 1, memory_order_relaxed);
+    if (slot >= record_capacity) return; //the trace is full, later orders are only counted
+    TraceRecord *record = &records[slot];
+    record->span = *span;
+    record->order_id = order_id;
+    record->x = x;
+    record->y = y;
+    record->status = status;
+    atomic_store_explicit(&record->ready, 1, memory_order_release);
+}
+
+//microseconds since the trace started, the unit of Chrome trace timestamps
+static double trace_us(uint64_t ns) {
+    return ns > start_ns ? (ns - start_ns) / 1e3 : 0;
+}
+
+static void write_record(FILE *out, TraceRecord *record) {
+    const OrderSpan *span = &record->span;
+    uint64_t first = span->ns[SPAN_RECEIVED], last = 0;
+    for (int i = 0; i < SPAN_POINTS; i++) {
+        if (span->ns[i] > last) last = span->ns[i];
+    }
+    if (first == 0) return; //accepted before tracing started
+    const char *status = record->status >= 0 && record->status <= 6 ? status_names[record->status] : "Unknown";
+
+    //one async track per order with its waits and work nested inside
+    fprintf(out, ",\n{\"name\":\"order %d\",\"cat\":\"order\",\"ph\":\"b\",\"id\":%d,\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{\"x\":%d,\"y\":%d,\"status\":\"%s\"}}",
+            record->order_id, record->order_id, trace_us(first), record->x, record->y, status);
+    for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+        const TracePhase *phase = &phases[p];
+        uint64_t from = span->ns[phase->from], to = span->ns[phase->to];
+        if (from == 0 || to < from) continue; //the order was canceled before this phase
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"order\",\"ph\":\"b\",\"id\":%d,\"pid\":1,\"tid\":0,\"ts\":%.3f}", phase->name, record->order_id, trace_us(from));
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"order\",\"ph\":\"e\",\"id\":%d,\"pid\":1,\"tid\":0,\"ts\":%.3f}", phase->name, record->order_id, trace_us(to));
+        if (phase->worker_pid != 0) {
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"work\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"order\":%d}}",
+                    phase->name, phase->worker_pid, span->thread_ids[phase->from], trace_us(from), (to - from) / 1e3, record->order_id);
+        }
+    }
+    fprintf(out, ",\n{\"name\":\"order %d\",\"cat\":\"order\",\"ph\":\"e\",\"id\":%d,\"pid\":1,\"tid\":0,\"ts\":%.3f}", record->order_id, record->order_id, trace_us(last));
+}
+
+//write the kept spans as Chrome trace JSON, which Perfetto and chrome://tracing open
+void trace_close(void) {
+    if (!atomic_exchange(&enabled, 0)) return;
+    FILE *out = fopen(trace_path, "w");
+    if (out == NULL) {
+        perror("Failed to open trace file");
+        return;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", process_names[1]);
+    for (int pid = 2; pid < (int)(sizeof(process_names) / sizeof(process_names[0])); pid++) {
+        fprintf(out, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid, process_names[pid]);
+    }
+    int count = atomic_load(&record_count);
+    int kept = count < record_capacity ? count : record_capacity;
+    for (int i = 0; i < kept; i++) {
+        if (atomic_load_explicit(&records[i].ready, memory_order_acquire)) write_record(out, &records[i]);
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+
+    printf("Traced %d orders to %s", kept, trace_path);
+    if (count > kept) printf(", %d later orders were not kept", count - kept);
+    printf("\n");
+}
@@ -0,0 +1,32 @@
+#ifndef ORDER_TRACE_H
+#define ORDER_TRACE_H
+
+#include <stdint.h>
+
+#define DEFAULT_TRACE_ORDERS 100000 //orders kept for the trace file
+
+//stage boundaries of an order, each one stamped with CLOCK_MONOTONIC when tracing is on
+typedef enum {
+    SPAN_RECEIVED, //the manager accepted the order
+    SPAN_PREP_START, //a cook took it from the preparation queue
+    SPAN_PREP_END, //the cook handed it to the cook queue
+    SPAN_OVEN_TAKEN, //an oven worker took it and started waiting for an oven slot
+    SPAN_COOK_START, //it got an oven slot
+    SPAN_READY, //cooked, waiting for a courier
+    SPAN_OUT, //a courier put it in the bag
+    SPAN_DELIVERED, //handed to the client
+    SPAN_POINTS
+} SpanPoint;
+
+//timestamps of an order, 0 for a boundary it never reached
+typedef struct {
+    uint64_t ns[SPAN_POINTS];
+    int thread_ids[SPAN_POINTS]; //worker that reached the boundary, -1 for the manager
+} OrderSpan;
+
+int trace_open(const char *path, int max_orders);
+void trace_mark(OrderSpan *span, SpanPoint point, int thread_id);
+void trace_order(const OrderSpan *span, int order_id, int x, int y, int status);
+void trace_close(void);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PIDE_PROTOCOL_H
+#define PIDE_PROTOCOL_H
+
+#include <stdint.h>
+
+//wire protocol between HungryVeryMuch and PideShop, integers in host byte order like the legacy handshake.
+//a legacy client sends two ints x, y on its own connection and gets bare int statuses back.
+//a framed client opens with a ProtocolHello instead, then pipelines any number of orders in FRAME_ORDERS
+//frames and gets a StatusFrame tagged with the order id for every status change. The first status of
+//every order is 0 (received), sent in the order the requests were submitted, which tells the client
+//the order id the shop gave each request; a request the shop refuses gets order id 0 and status 7 (busy).
+//a FRAME_SUBSCRIBE frame picks which later status changes the orders placed after it are sent, status 0
+//and cancellations are always sent so the client can match ids and never waits for an order forever.
+
+#define PROTOCOL_MAGIC 0x45444950u //"PIDE" in memory, far outside any town so it is never read as a coordinate
+#define PROTOCOL_VERSION 1
+#define FRAME_ORDERS 1 //client to shop, payload is an array of OrderRequest
+#define FRAME_STATUS 2 //shop to client, payload is the order id and status of a StatusFrame
+#define FRAME_SUBSCRIBE 3 //client to shop, payload is the uint32_t subscription level of the orders that follow
+#define MAX_FRAME_ORDERS 1024 //requests in one FRAME_ORDERS frame
+
+#define STATUS_BIT(status) (1u << (status))
+#define SUBSCRIBE_FULL_MASK 0x7fu //every status from 0 received to 6 canceled
+#define SUBSCRIBE_MILESTONES_MASK (STATUS_BIT(0) | STATUS_BIT(4) | STATUS_BIT(5) | STATUS_BIT(6))
+#define SUBSCRIBE_FINAL_MASK (STATUS_BIT(0) | STATUS_BIT(5) | STATUS_BIT(6))
+
+//notification level of a framed client, the default is SUBSCRIBE_FULL
+typedef enum {
+    SUBSCRIBE_FULL, //every status change
+    SUBSCRIBE_MILESTONES, //out for delivery, delivered and canceled
+    SUBSCRIBE_FINAL //delivered or canceled only
+} SubscriptionLevel;
+
+//first message of a framed connection, the shop answers with the version it speaks or 0 before it hangs up
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} ProtocolHello;
+
+//every frame after the hello starts with this header
+typedef struct {
+    uint32_t length; //bytes of payload after the header
+    uint32_t type; //FRAME_ORDERS, FRAME_STATUS or FRAME_SUBSCRIBE
+} FrameHeader;
+
+//one order in a FRAME_ORDERS frame
+typedef struct {
+    int32_t x, y; //coordinates of the delivery address
+} OrderRequest;
+
+//status change of one order
+typedef struct {
+    FrameHeader header;
+    uint32_t order_id;
+    int32_t status;
+} StatusFrame;
+
+#define MAX_FRAME_PAYLOAD (MAX_FRAME_ORDERS * sizeof(OrderRequest))
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,145 +12,369 @@
 #include <time.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <semaphore.h>
-#include <complex.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "stageQueue.h"
+#include "orderLog.h"
+#include "orderJournal.h"
+#include "kitchenKernel.h"
+#include "deliveryDispatch.h"
+#include "latencyHistogram.h"
+#include "timerWheel.h"
+#include "orderSlab.h"
+#include "statusEgress.h"
+#include "pideProtocol.h"
+#include "shopCore.h"
+#include "shopMetrics.h"
+#include "orderTrace.h"
+#include "cpuPlacement.h"
+#include "elasticPool.h"
+#include "shopWorkers.h"
 
 //constants for defining maximum orders, oven size, delivery bag size, and times for preparation and cooking
-#define MAX_ORDERS 1000
+#define DEFAULT_ORDER_CAPACITY 1024 //order slots allocated at startup
+#define DEFAULT_MAX_LIVE_ORDERS 65536 //orders in progress at once, slots are reused once an order is delivered or canceled
+#define HANG_UP_TAG (1ull << 63) //marks epoll data that holds an order handle, handles never set the top two bits
+#define CONNECTION_TAG (1ull << 62) //marks epoll data that holds the handle of a framed connection that sent its last request
+#define CONNECTION_SLAB_SIZE 1024 //connection slots allocated at startup
+#define MAX_CONNECTIONS (1 << 20) //connections open at once
 #define MAX_OVEN_SIZE 6
-#define MAX_DELIVERY_BAG 3
+#define MAX_EPOLL_EVENTS 256 //events handled per epoll_wait call
+#define ORDER_REQUEST_SIZE (2 * sizeof(int)) //x and y coordinates sent by a legacy client, or the hello of a framed one
+#define MAX_FRAMES_PER_WAKEUP 16 //frames read from one connection before the ingress loop serves the others
+#define DEFAULT_SCALE_TARGET_MS 20 //stage wait above which the autoscaler adds workers
+#define DEFAULT_SCALE_INTERVAL_MS 100 //time between two autoscaler decisions
+#define SCALE_BACKLOG_PER_WORKER 4 //waiting orders per active worker above which the autoscaler adds workers
+#define SCALE_CALM_INTERVALS 10 //intervals without backlog before the autoscaler retires a worker
+#define INGRESS_PAUSE_POLL_MS 1 //how often a paused ingress loop checks whether the stages drained
 
-//structure for hold order info
-typedef struct {
-    int order_id;
-    int x, y; //coordinates of the delivery address
-    time_t order_time; //time the order was placed
-    int status; //status of the order (0: ordered, 1: preparing, 2: cooking, 3: ready for delivery, 4: out for delivery, 5: delivered, 6: canceled)
-    int client_socket; //socket to communicate with the client
-    int canceled_flag; // flag to indicate if the order was canceled
-} Order;
-
-//structure for cook
-typedef struct {
-    pthread_t thread; //thread ID
-    int id; //cook ID
-    Order *order; //order being prepared by the cook
-    int prepared_orders; //number of orders prepared by the cook
-} Cook;
+//structure for a customer connection whose order is still arriving, or a framed connection that sends many orders
+typedef struct Connection {
+    int socket; //client socket
+    unsigned char buffer[ORDER_REQUEST_SIZE]; //partially received order request
+    size_t received; //number of bytes received so far
+    bool framed; //the client spoke the framed protocol, the connection lives until it hangs up
+    unsigned char *frame; //frame being received, framed connections only
+    size_t frame_received; //bytes of the frame received so far
+    atomic_int refs; //held by the ingress loop and by every order in progress, the socket closes with the last one
+    atomic_int hung_up; //the client disconnected, stages drop its orders
+    uint32_t notify_mask; //subscription of the orders the client places next, framed connections only
+    struct Connection *next_paused; //next connection left unread while the stages are full
+} Connection;
 
-//structure fordelivery person
+//structure for a pool the autoscaler watches
 typedef struct {
-    pthread_t thread; //thread ID
-    int id; //delivery person ID
-    int speed; //speed of the delivery person
-    Order *bag[MAX_DELIVERY_BAG]; //bag to hold orders for delivery
-    int bag_count; //number of orders in the bag
-    int delivered_orders; //number of orders delivered by the delivery person
-} DeliveryPerson;
+    ElasticPool *pool;
+    const char *name;
+    int calm_intervals; //consecutive intervals without a backlog
+    uint64_t last_wait_ns, last_count; //wait counters at the previous interval
+} ScaledPool;
 
 // Global variables
 int port; //server port
 int cook_pool_size ;//number of cooks, and number of delivery persons
 int delivery_pool_size; //number of delivery persons
+int delivery_speed; //speed of the couriers, also used to estimate delivery times for scheduling
+int oven_pool_size = MAX_OVEN_SIZE; //number of oven workers
 Cook *cooks; //array of cooks
+OvenWorker *oven_workers; //array of oven workers
 DeliveryPerson *delivery_persons; //array of delivery persons
-Order orders[MAX_ORDERS]; //array of all orders
-Order *prep_queue[MAX_ORDERS]; //queue for waiting for prepared
-Order *cook_queue[MAX_ORDERS]; //queue for waiting for cooked
-Order *delivery_queue[MAX_ORDERS]; //queue for waiting for delivered
+CourierEngine *courier_engines; //threads of the wheel delivery engine
+LatencyHistogram *pickup_histograms; //one per delivery thread
+int pickup_histogram_count = 0; //number of pickup histograms
+DispatchGrid ready_grid; //ready orders by location, filled from the delivery queue by the couriers
 int order_count = 0; //total number of orders
-int prep_queue_start = 0, prep_queue_end = 0; //indices for the preparation queue
-int cook_queue_start = 0, cook_queue_end = 0; //indices for the cooking queue
-int delivery_queue_start = 0, delivery_queue_end = 0; //indices for the delivery queue
+uint32_t order_capacity = DEFAULT_ORDER_CAPACITY; //order slots allocated at startup
+uint32_t max_live_orders = DEFAULT_MAX_LIVE_ORDERS; //the order slab grows in chunks up to this many slots
+EgressMode egress_mode = EGRESS_AUTO; //how the sender thread writes statuses to clients
 int delivered_count = 0; //count of delivered orders
+int listen_backlog = SOMAXCONN; //backlog of pending connections for listen()
+int log_flush_ms = DEFAULT_LOG_FLUSH_MS; //flush interval of the log writer thread
+char *journal_prefix = NULL; //when set, status changes go to a binary journal instead of pide_shop.log
+char *trace_path = NULL; //when set, the stage boundaries of every order are written there as Chrome trace JSON on shutdown
+int trace_orders = DEFAULT_TRACE_ORDERS; //most orders kept for the trace
+SchedPolicy sched_policy = SCHEDULE_FIFO; //order in which cooks and ovens serve waiting orders
+bool work_stealing = false; //every cook has its own preparation queue and steals when it runs empty
+char *ingress_cpus = NULL; //CPU list of the accept loop and the I/O threads, NULL to leave them unpinned
+char *kitchen_cpus = NULL; //CPU list of the cooks and oven workers
+char *delivery_cpus = NULL; //CPU list of the courier or wheel engine threads
+PlacementPolicy placement_policy = PLACEMENT_SHARED; //how the kitchen and delivery threads are spread over their CPUs
+bool placement_enabled = false; //any placement option was given
+CpuPool kitchen_pool, delivery_pool; //slots the kitchen and delivery threads are pinned to
+int max_cooks = 0; //cooks the pool may grow to, at most cook_pool_size when 0
+int max_couriers = 0; //courier threads the pool may grow to, at most delivery_pool_size when 0
+int scale_target_ms = DEFAULT_SCALE_TARGET_MS; //stage wait the autoscaler tries to stay under
+int scale_interval_ms = DEFAULT_SCALE_INTERVAL_MS; //how often the autoscaler looks at the queues
+ElasticPool cook_scaling, courier_scaling; //active cooks and courier threads, the rest are parked
+atomic_uint_fast64_t prep_wait_ns, prep_wait_count; //time orders waited for a cook, for the autoscaler
+int journal_segment_mb = DEFAULT_JOURNAL_SEGMENT_MB; //size of one journal segment
+KernelType kernel_type = KERNEL_AUTO; //implementation of the preparation and cooking kernel
+int grid_cell_size = DEFAULT_GRID_CELL; //side of a cell of the ready order grid
+double bag_radius = 0; //max distance of bag orders from the oldest one, 0 for any distance
+int bag_wait_ms = 0; //how long a courier waits for a full bag after the oldest order became ready
+bool wheel_engine = false; //drive couriers as timers on a few threads instead of one thread each
+int wheel_threads = 2; //threads of the wheel delivery engine
+int wheel_tick_us = DEFAULT_WHEEL_TICK_US; //resolution of the courier timers
+atomic_uint_fast64_t prep_work_ns, prep_work_count; //time spent in the preparation kernel, for the mean
+atomic_uint_fast64_t cook_work_ns, cook_work_count; //time spent in the cooking kernel, for the mean
+atomic_uint_fast64_t hung_up_orders; //orders dropped because the client disconnected
+atomic_uint_fast64_t saved_cook_ns, saved_oven_ns; //estimated cook and oven slot time not spent on them
+atomic_uint_fast64_t unsubscribed_statuses; //status changes not written because the client did not subscribe to them
+int metrics_port = 0; //local port of the Prometheus stats socket, 0 to not export metrics
+int sla_ms = 0; //estimated delivery time past which new orders are turned away as busy, 0 to admit every order
+int stage_bound = 0; //orders a stage may hold before the ingress stops reading new ones, 0 for no bound
+atomic_int ovens_cooking; //orders in an oven right now
+atomic_int ready_backlog; //ready orders no courier has picked up yet
+atomic_uint_fast64_t route_ns, route_count; //time couriers spent on their round trips, for the admission estimate
+atomic_uint_fast64_t busy_orders; //orders turned away because the shop was past its SLA or out of order slots
+bool ingress_paused = false; //a stage is full and the ingress loop reads no new orders, ingress thread only
+Slab connection_slab; //connections, slots are only allocated by the ingress loop
+Connection *paused_connections = NULL; //connections left out of the epoll set while paused, ingress thread only
+uint64_t pause_start_ns, paused_ns, ingress_pauses; //how long and how often the ingress was paused, ingress thread only
 
-pthread_mutex_t order_mutex = PTHREAD_MUTEX_INITIALIZER; //mutex to protect order-related operations
-pthread_cond_t order_cond = PTHREAD_COND_INITIALIZER; //condition variable for order processing
-pthread_cond_t delivery_cond = PTHREAD_COND_INITIALIZER; //condition variable for delivery processing
+pthread_mutex_t order_mutex = PTHREAD_MUTEX_INITIALIZER; //mutex to protect the orders array and completion counters
+pthread_mutex_t delivery_mutex = PTHREAD_MUTEX_INITIALIZER; //mutex to protect the ready order grid
 sem_t oven_sem; //semaphore to manage the oven capacity
 
-FILE *log_file; //log file to record order status
-
 // Function prototypes
 void *cook_routine(void *arg);
+void *oven_routine(void *arg);
 void *delivery_routine(void *arg);
-void manager(int socket);
-void log_order_status(Order *order, int status, int thread_id);
-int calculate_delivery_time(int x, int y, int speed);
+SlabHandle manager(int socket, int x, int y, Connection *connection);
+int parse_arguments(int argc, char *argv[]);
+int set_nonblocking(int socket, int enable);
+void ingress_loop(int server_socket, int signal_fd);
+void accept_connections(int epoll_fd, int server_socket);
+void handle_connection(int epoll_fd, Connection *connection, uint32_t events);
+void watch_hang_up(int epoll_fd, int socket, SlabHandle handle);
+void start_framed_connection(int epoll_fd, Connection *connection, uint32_t version);
+void read_frames(int epoll_fd, Connection *connection);
+void close_framed_connection(int epoll_fd, Connection *connection);
+void end_framed_requests(int epoll_fd, Connection *connection);
+void free_connection(Connection *connection);
+void release_connection(Connection *connection);
+bool stages_full(void);
+void update_ingress_pause(int epoll_fd, int server_socket);
+void pause_connection(int epoll_fd, Connection *connection);
+uint64_t estimated_completion_ns(int x, int y);
+void refuse_order(int socket, Connection *connection);
+uint32_t subscription_mask(uint32_t level);
+bool drop_hung_up_order(Order *order, bool saves_prep, bool saves_oven);
+uint64_t mean_work_ns(atomic_uint_fast64_t *total, atomic_uint_fast64_t *count);
+uint64_t estimated_order_ns(Order *order);
+void deliver_bag(DeliveryPerson *delivery_person);
+int take_delivery_batch(void **batch);
+int try_take_delivery_batch(void **batch, uint32_t *watched, uint64_t *timeout_ns);
+void load_bag(DeliveryPerson *delivery_person, void **batch, int count, uint64_t pickup_ns);
+void complete_delivery(DeliveryPerson *delivery_person, Order *order);
+void *courier_engine_routine(void *arg);
+void start_route(CourierEngine *engine, DeliveryPerson *delivery_person, void **batch, int count, uint64_t now);
+void schedule_next_leg(CourierEngine *engine, DeliveryPerson *delivery_person, uint64_t now);
+void courier_arrived(CourierEngine *engine, DeliveryPerson *delivery_person, uint64_t now);
+int start_delivery_engine(int delivery_speed);
+int start_metrics(int port);
+int pool_cpus(const char *list, const cpu_set_t *online, const cpu_set_t *ingress, cpu_set_t *cpus);
+int setup_placement(void);
+void scale_pool(ScaledPool *scaled, size_t backlog, uint64_t wait_ns, uint64_t count);
+void *autoscaler_routine(void *arg);
+void place_thread(CpuPool *pool, pthread_t thread, int index);
+double prep_queue_depth(void);
+double cook_queue_depth(void);
+double delivery_queue_depth(void);
+double ready_order_count(void);
+double oven_occupancy(void);
+double live_order_count(void);
+double busy_order_count(void);
+double ingress_paused_flag(void);
+void steal_totals(uint64_t *own, uint64_t *stolen, uint64_t *failed);
+double own_prep_orders(void);
+double stolen_prep_orders(void);
+double failed_prep_steals(void);
+void print_work_stealing();
+void index_ready_orders(Order *first);
+void print_pickup_latency();
 void signal_handler(int signal);
-void enqueue_preparation(Order *order);
-Order *dequeue_preparation();
-void enqueue_cooking(Order *order);
-Order *dequeue_cooking();
-void enqueue_delivery(Order *order);
-Order *dequeue_delivery();
-void simulate_computation_delay_prep();
-void simulate_computation_delay_cook();
 void notify_clients_all_orders_completed();
 void cancel_order(Order *order);
+void finish_order(Order *order);
+void notify_status(Order *order, int status);
+void print_egress_stats();
+void print_admission();
 void print_most_efficient_workers();
+void print_cancellation_savings();
 
-// Signal handler for graceful shutdown
+// Signal handler for graceful shutdown, called from the ingress loop when SIGINT arrives on the signalfd
 void signal_handler(int signal) {
     if (signal == SIGINT) {
         pthread_mutex_lock(&order_mutex);
         printf("\nRIP PIDE SHOP...\n");
-        for (int i = 0; i < order_count; i++) {
-            if (orders[i].status != 5) {
-                orders[i].status = 6;
-                log_order_status(&orders[i], 6, -1);
+        for (uint32_t i = 0; i < slab_capacity(&order_slab); i++) {
+            Order *order = slab_at(&order_slab, i);
+            if (order != NULL && order->status != 5) {
+                order->status = 6;
+                log_order_status(order, 6, -1);
+                trace_order(&order->span, order->order_id, order->x, order->y, 6); //shows where the order was stuck
             }
         }
         print_most_efficient_workers();
+        print_pickup_latency();
+        print_cancellation_savings();
+        print_work_stealing();
+        print_admission();
+        print_egress_stats();
         pthread_mutex_unlock(&order_mutex);
-        fclose(log_file);
+        egress_close(); //writes the statuses still queued
+        order_log_close(); //writes every buffered event before closing the log
+        trace_close();
         exit(0);
     }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 6) {
-        printf("Usage: %s <ip_address> <port> <cook_pool_size> <delivery_pool_size> <delivery_speed>\n", argv[0]);
+    int first_arg = parse_arguments(argc, argv);
+    if (first_arg < 0) {
+        printf("Usage: %s <ip_address> <port> <cook_pool_size> <delivery_pool_size> <delivery_speed> [--backlog N] [--log-flush-ms N] [--journal PREFIX] [--journal-segment-mb N] [--kernel auto|scalar|avx2|avx512] [--oven-workers N] [--grid-cell N] [--bag-radius R] [--bag-wait-ms N] [--delivery-engine threads|wheel] [--wheel-threads N] [--wheel-tick-us N] [--order-capacity N] [--max-live-orders N] [--egress auto|uring|epoll] [--metrics-port N] [--trace FILE] [--trace-orders N] [--schedule fifo|edf|stf] [--cook-queues shared|stealing] [--ingress-cpus LIST] [--kitchen-cpus LIST] [--delivery-cpus LIST] [--placement shared|per-core|no-smt] [--max-cooks N] [--max-couriers N] [--scale-target-ms N] [--scale-interval-ms N] [--sla-ms N] [--stage-bound N]\n", argv[0]);
         return 1;
     }
 
-    char *ip_address = argv[1]; //IP address 
-    port = atoi(argv[2]); //port number
-    cook_pool_size = atoi(argv[3]); //number of cooks
-    delivery_pool_size = atoi(argv[4]); //number of delivery persons
-    int delivery_speed = atoi(argv[5]); //speed of delivery
+    char *ip_address = argv[first_arg]; //IP address 
+    port = atoi(argv[first_arg + 1]); //port number
+    cook_pool_size = atoi(argv[first_arg + 2]); //number of cooks
+    delivery_pool_size = atoi(argv[first_arg + 3]); //number of delivery persons
+    delivery_speed = atoi(argv[first_arg + 4]); //speed of delivery
+
+    //elastic pools are created at their largest size and start with the given number of workers active
+    elastic_pool_init(&cook_scaling, cook_pool_size, max_cooks > cook_pool_size ? max_cooks : cook_pool_size);
+    if (max_couriers > delivery_pool_size && wheel_engine) {
+        printf("Courier autoscaling needs the threads delivery engine, wheel couriers cost nothing while idle\n");
+        max_couriers = 0;
+    }
+    elastic_pool_init(&courier_scaling, delivery_pool_size, max_couriers > delivery_pool_size ? max_couriers : delivery_pool_size);
+    cook_pool_size = cook_scaling.max;
+    delivery_pool_size = courier_scaling.max;
 
-    signal(SIGINT, signal_handler); //setup signal handler for graceful shutdown
+    //SIGINT is blocked in every thread and read from a signalfd by the ingress loop
+    sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+    int signal_fd = signalfd(-1, &shutdown_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("Failed to create signalfd");
+        return 1;
+    }
     signal(SIGPIPE, SIG_IGN); //ignore SIGPIPE signals
 
-    cooks = malloc(cook_pool_size * sizeof(Cook)); //allocate memory for cooks
-    delivery_persons = malloc(delivery_pool_size * sizeof(DeliveryPerson)); //allocate memory for delivery persons
+    //pin the ingress thread before any other thread starts, the I/O threads it creates inherit its CPUs
+    if (placement_enabled && setup_placement() < 0) return 1;
+
+    cooks = aligned_alloc(CACHE_LINE_SIZE, cook_pool_size * sizeof(Cook)); //allocate memory for cooks, one block of cache lines each
+    oven_workers = aligned_alloc(CACHE_LINE_SIZE, oven_pool_size * sizeof(OvenWorker)); //allocate memory for oven workers
 
-    log_file = fopen("pide_shop.log", "w"); //open log file
-    if (log_file == NULL) {
+    //open log file or journal and start the log writer
+    if (journal_prefix != NULL) {
+        if (order_log_open_journal(journal_prefix, (size_t)journal_segment_mb << 20, log_flush_ms) < 0) {
+            printf("Failed to open journal %s\n", journal_prefix);
+            return 1;
+        }
+    } else if (order_log_open("pide_shop.log", log_flush_ms) < 0) {
         printf("Failed to open log file\n");
         return 1;
     }
 
+    //stage boundaries are only stamped when a trace is asked for
+    if (trace_path != NULL && trace_open(trace_path, trace_orders) < 0) {
+        printf("Failed to allocate the trace of %d orders\n", trace_orders);
+        return 1;
+    }
+
+    //initialize the order slots, the connection slots and the queues between the stages
+    if (shop_core_init(order_capacity, max_live_orders, sched_policy) < 0 || slab_init(&connection_slab, sizeof(Connection), CONNECTION_SLAB_SIZE, MAX_CONNECTIONS) < 0) {
+        printf("Failed to allocate order slots and queues\n");
+        return 1;
+    }
+    if (work_stealing && shop_core_steal_preparation(cook_pool_size) < 0) {
+        printf("Failed to allocate the preparation queues of the cooks\n");
+        return 1;
+    }
+    shop_core_active_cooks(elastic_pool_size(&cook_scaling));
+
+    //pick the preparation and cooking kernel and make sure it matches the reference loop
+    if (kernel_select(kernel_type) < 0) {
+        printf("Kernel is not supported by this CPU\n");
+        return 1;
+    }
+    if (kernel_self_check() < 0) {
+        printf("Kernel %s does not match the reference, falling back to scalar\n", kernel_name());
+        kernel_select(KERNEL_SCALAR);
+    }
+    printf("Using %s kitchen kernel\n", kernel_name());
+
+    //statuses are written by one sender thread, every order queues at most a handful before it is released
+    if (egress_open(egress_mode, (size_t)max_live_orders * 8) < 0) {
+        printf("Failed to start the status egress\n");
+        return 1;
+    }
+    printf("Using %s status egress\n", egress_mode_name());
+    printf("Cooks and ovens take orders %s\n", sched_policy_name(sched_policy));
+    if (sla_ms > 0) printf("Turning orders away as busy when their estimated delivery is over %d ms\n", sla_ms);
+    if (stage_bound > 0) printf("Ingress pauses while a stage holds %d orders\n", stage_bound);
+
+    dispatch_init(&ready_grid, grid_cell_size);
     sem_init(&oven_sem, 0, MAX_OVEN_SIZE); //initialize semaphore for oven capacity
 
     //create cook threads
     for (int i = 0; i < cook_pool_size; i++) {
         cooks[i].id = i;
+        cooks[i].prepared_orders = 0;
+        cooks[i].metrics = metrics_worker("cook", i);
         pthread_create(&cooks[i].thread, NULL, cook_routine, &cooks[i]);
+        place_thread(&kitchen_pool, cooks[i].thread, i);
     }
 
-    //create delivery person threads
-    for (int i = 0; i < delivery_pool_size; i++) {
-        delivery_persons[i].id = i;
-        delivery_persons[i].speed = delivery_speed;
-        delivery_persons[i].bag_count = 0;
-        pthread_create(&delivery_persons[i].thread, NULL, delivery_routine, &delivery_persons[i]);
+    //create oven worker threads
+    for (int i = 0; i < oven_pool_size; i++) {
+        oven_workers[i].id = i;
+        oven_workers[i].cooked_orders = 0;
+        oven_workers[i].metrics = metrics_worker("oven", i);
+        pthread_create(&oven_workers[i].thread, NULL, oven_routine, &oven_workers[i]);
+        place_thread(&kitchen_pool, oven_workers[i].thread, cook_pool_size + i);
+    }
+
+    //create delivery person threads, or the wheel engine threads that drive them
+    if (start_delivery_engine(delivery_speed) < 0) {
+        printf("Failed to start the delivery engine\n");
+        return 1;
     }
 
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_len;
+    //queue depths, oven occupancy and worker utilization are read when scraped, transitions are recorded per thread
+    if (metrics_port > 0) {
+        if (start_metrics(metrics_port) < 0) {
+            printf("Failed to open the metrics socket on port %d\n", metrics_port);
+            return 1;
+        }
+        printf("Serving metrics on 127.0.0.1:%d\n", metrics_port);
+    }
+
+    //grow and shrink the cook and courier pools with the load
+    if (cook_scaling.max > cook_scaling.min || courier_scaling.max > courier_scaling.min) {
+        pthread_t autoscaler;
+        if (pthread_create(&autoscaler, NULL, autoscaler_routine, NULL) != 0) {
+            printf("Failed to start the autoscaler\n");
+            return 1;
+        }
+        printf("Autoscaling cooks %d-%d and couriers %d-%d, target wait %d ms\n", cook_scaling.min, cook_scaling.max,
+               courier_scaling.min, courier_scaling.max, scale_target_ms);
+    }
+
+    int server_socket;
+    struct sockaddr_in server_addr;
 
     server_socket = socket(AF_INET, SOCK_STREAM, 0); //create server socket
     if (server_socket < 0) {
@@ -176,82 +401,696 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    listen(server_socket, 5); //start listening for incoming connections
+    if (listen(server_socket, listen_backlog) < 0) { //start listening for incoming connections
+        perror("Failed to listen on socket");
+        return 1;
+    }
+    if (set_nonblocking(server_socket, 1) < 0) {
+        perror("Failed to make server socket non-blocking");
+        return 1;
+    }
     printf("Pide Shop server listening on %s address and %d port\n", ip_address, port);
 
+    ingress_loop(server_socket, signal_fd); //accept and parse orders until shutdown
+
+    return 0;
+}
+
+//parse command line options, returns the index of the first positional argument or -1 on error
+int parse_arguments(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"backlog", required_argument, NULL, 'b'},
+        {"log-flush-ms", required_argument, NULL, 'l'},
+        {"journal", required_argument, NULL, 'j'},
+        {"journal-segment-mb", required_argument, NULL, 'J'},
+        {"kernel", required_argument, NULL, 'k'},
+        {"oven-workers", required_argument, NULL, 'o'},
+        {"grid-cell", required_argument, NULL, 'g'},
+        {"bag-radius", required_argument, NULL, 'r'},
+        {"bag-wait-ms", required_argument, NULL, 'w'},
+        {"delivery-engine", required_argument, NULL, 'e'},
+        {"wheel-threads", required_argument, NULL, 'W'},
+        {"wheel-tick-us", required_argument, NULL, 'T'},
+        {"order-capacity", required_argument, NULL, 'c'},
+        {"max-live-orders", required_argument, NULL, 'm'},
+        {"egress", required_argument, NULL, 'E'},
+        {"metrics-port", required_argument, NULL, 'M'},
+        {"trace", required_argument, NULL, 't'},
+        {"trace-orders", required_argument, NULL, 'O'},
+        {"schedule", required_argument, NULL, 's'},
+        {"cook-queues", required_argument, NULL, 'q'},
+        {"ingress-cpus", required_argument, NULL, 'I'},
+        {"kitchen-cpus", required_argument, NULL, 'K'},
+        {"delivery-cpus", required_argument, NULL, 'D'},
+        {"placement", required_argument, NULL, 'P'},
+        {"max-cooks", required_argument, NULL, 'C'},
+        {"max-couriers", required_argument, NULL, 'X'},
+        {"scale-target-ms", required_argument, NULL, 'G'},
+        {"scale-interval-ms", required_argument, NULL, 'L'},
+        {"sla-ms", required_argument, NULL, 'S'},
+        {"stage-bound", required_argument, NULL, 'B'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:l:j:J:k:o:g:r:w:e:W:T:c:m:E:M:t:O:s:q:I:K:D:P:C:X:G:L:S:B:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b':
+                listen_backlog = atoi(optarg);
+                if (listen_backlog <= 0) {
+                    printf("Backlog must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'l':
+                log_flush_ms = atoi(optarg);
+                if (log_flush_ms <= 0) {
+                    printf("Log flush interval must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'j':
+                journal_prefix = optarg;
+                break;
+            case 'J':
+                journal_segment_mb = atoi(optarg);
+                if (journal_segment_mb <= 0) {
+                    printf("Journal segment size must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'k':
+                if (kernel_parse_type(optarg, &kernel_type) < 0) {
+                    printf("Unknown kernel %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'o':
+                oven_pool_size = atoi(optarg);
+                if (oven_pool_size <= 0) {
+                    printf("Number of oven workers must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'g':
+                grid_cell_size = atoi(optarg);
+                if (grid_cell_size <= 0) {
+                    printf("Grid cell size must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'r':
+                bag_radius = atof(optarg);
+                if (!(bag_radius >= 0)) { //also rejects nan
+                    printf("Bag radius must not be negative\n");
+                    return -1;
+                }
+                break;
+            case 'w':
+                bag_wait_ms = atoi(optarg);
+                if (bag_wait_ms < 0) {
+                    printf("Bag wait must not be negative\n");
+                    return -1;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "threads") == 0) {
+                    wheel_engine = false;
+                } else if (strcmp(optarg, "wheel") == 0) {
+                    wheel_engine = true;
+                } else {
+                    printf("Unknown delivery engine %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'W':
+                wheel_threads = atoi(optarg);
+                if (wheel_threads <= 0) {
+                    printf("Number of wheel threads must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'T':
+                wheel_tick_us = atoi(optarg);
+                if (wheel_tick_us <= 0) {
+                    printf("Wheel tick must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'c':
+                if (atoi(optarg) <= 0) {
+                    printf("Order capacity must be positive\n");
+                    return -1;
+                }
+                order_capacity = atoi(optarg);
+                break;
+            case 'm':
+                if (atoi(optarg) <= 0) {
+                    printf("Maximum live orders must be positive\n");
+                    return -1;
+                }
+                max_live_orders = atoi(optarg);
+                break;
+            case 'E':
+                if (egress_parse_mode(optarg, &egress_mode) < 0) {
+                    printf("Unknown egress mode %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'M':
+                metrics_port = atoi(optarg);
+                if (metrics_port <= 0 || metrics_port > 65535) {
+                    printf("Metrics port must be between 1 and 65535\n");
+                    return -1;
+                }
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'O':
+                trace_orders = atoi(optarg);
+                if (trace_orders <= 0) {
+                    printf("Number of traced orders must be positive\n");
+                    return -1;
+                }
+                break;
+            case 's':
+                if (sched_parse_policy(optarg, &sched_policy) < 0) {
+                    printf("Unknown scheduling policy %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'q':
+                if (strcmp(optarg, "shared") == 0) {
+                    work_stealing = false;
+                } else if (strcmp(optarg, "stealing") == 0) {
+                    work_stealing = true;
+                } else {
+                    printf("Unknown cook queues %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'I':
+                ingress_cpus = optarg;
+                placement_enabled = true;
+                break;
+            case 'K':
+                kitchen_cpus = optarg;
+                placement_enabled = true;
+                break;
+            case 'D':
+                delivery_cpus = optarg;
+                placement_enabled = true;
+                break;
+            case 'P':
+                if (cpu_parse_policy(optarg, &placement_policy) < 0) {
+                    printf("Unknown placement %s\n", optarg);
+                    return -1;
+                }
+                placement_enabled = true;
+                break;
+            case 'C':
+                max_cooks = atoi(optarg);
+                if (max_cooks <= 0) {
+                    printf("Maximum number of cooks must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'X':
+                max_couriers = atoi(optarg);
+                if (max_couriers <= 0) {
+                    printf("Maximum number of couriers must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'G':
+                scale_target_ms = atoi(optarg);
+                if (scale_target_ms <= 0) {
+                    printf("Autoscaler target wait must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'L':
+                scale_interval_ms = atoi(optarg);
+                if (scale_interval_ms <= 0) {
+                    printf("Autoscaler interval must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'S':
+                sla_ms = atoi(optarg);
+                if (sla_ms <= 0) {
+                    printf("SLA must be positive\n");
+                    return -1;
+                }
+                break;
+            case 'B':
+                stage_bound = atoi(optarg);
+                if (stage_bound <= 0) {
+                    printf("Stage bound must be positive\n");
+                    return -1;
+                }
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (order_capacity > max_live_orders) order_capacity = max_live_orders;
+    if (argc - optind != 5) return -1;
+    return optind;
+}
+
+//switch a socket between blocking and non-blocking mode
+int set_nonblocking(int socket, int enable) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0) return -1;
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(socket, F_SETFL, flags);
+}
+
+//markers that tell the non-connection descriptors apart in epoll events
+static char listen_marker, signal_marker;
+
+//event loop that accepts customers and reads their orders without blocking on any of them
+void ingress_loop(int server_socket, int signal_fd) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("Failed to create epoll instance");
+        exit(1);
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_marker;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &event) < 0) {
+        perror("Failed to watch server socket");
+        exit(1);
+    }
+    event.data.ptr = &signal_marker;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) < 0) {
+        perror("Failed to watch signalfd");
+        exit(1);
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
     while (1) {
-        addr_len = sizeof(client_addr);
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &addr_len); //accept a new client 
+        if (stage_bound > 0) update_ingress_pause(epoll_fd, server_socket);
+        int ready = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, ingress_paused ? INGRESS_PAUSE_POLL_MS : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            exit(1);
+        }
+
+        for (int i = 0; i < ready; i++) {
+            if (events[i].data.ptr == &listen_marker) {
+                accept_connections(epoll_fd, server_socket);
+            } else if (events[i].data.ptr == &signal_marker) {
+                struct signalfd_siginfo info;
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) signal_handler(info.ssi_signo);
+            } else if (events[i].data.u64 & HANG_UP_TAG) {
+                //hang-up of a client whose order is in the kitchen. Only this thread allocates orders,
+                //so a slot found through a current handle is not reused before the mark is set
+                Order *order = slab_get(&order_slab, events[i].data.u64 & ~HANG_UP_TAG);
+                if (order != NULL) atomic_store(&order->hung_up, 1);
+            } else if (events[i].data.u64 & CONNECTION_TAG) {
+                //hang-up of a framed client that sent its last request and waits for statuses, found like an order above
+                Connection *connection = slab_get(&connection_slab, events[i].data.u64 & ~CONNECTION_TAG);
+                if (connection != NULL) atomic_store(&connection->hung_up, 1);
+            } else {
+                if (stage_bound > 0) update_ingress_pause(epoll_fd, server_socket);
+                if (ingress_paused) {
+                    pause_connection(epoll_fd, events[i].data.ptr); //its orders wait in the socket buffer
+                } else {
+                    handle_connection(epoll_fd, events[i].data.ptr, events[i].events);
+                }
+            }
+        }
+    }
+}
+
+//true when a stage holds stage_bound orders; once paused, the ingress stays paused until every stage is under three quarters of it
+bool stages_full(void) {
+    size_t limit = ingress_paused ? stage_bound - stage_bound / 4 : stage_bound;
+    return preparation_depth() >= limit || sched_queue_depth(&cook_queue) >= limit || (size_t)atomic_load(&ready_backlog) >= limit;
+}
+
+//stop reading new orders while a stage is full and start again once it drained. Unread orders back up in the
+//socket buffers and the listen backlog, so TCP flow control slows the clients down instead of the queues growing
+void update_ingress_pause(int epoll_fd, int server_socket) {
+    bool full = stages_full();
+    if (full == ingress_paused) return;
+
+    ingress_paused = full;
+    struct epoll_event event;
+    event.events = full ? 0 : EPOLLIN;
+    event.data.ptr = &listen_marker;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, server_socket, &event);
+    if (full) {
+        pause_start_ns = monotonic_ns();
+        ingress_pauses++;
+        return;
+    }
+
+    paused_ns += monotonic_ns() - pause_start_ns;
+    while (paused_connections != NULL) {
+        Connection *connection = paused_connections;
+        paused_connections = connection->next_paused;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = connection;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection->socket, &event) < 0) perror("Failed to watch client socket");
+    }
+}
+
+//leave a connection with pending orders out of the epoll set until the ingress resumes, so it does not wake the loop
+void pause_connection(int epoll_fd, Connection *connection) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+    connection->next_paused = paused_connections;
+    paused_connections = connection;
+}
+
+//accept every pending connection so bursts drain in one wakeup
+void accept_connections(int epoll_fd, int server_socket) {
+    while (1) {
+        int client_socket = accept4(server_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC); //accept a new client
         if (client_socket < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
             perror("Failed to accept connection");
+            return;
+        }
+
+        Connection *connection = slab_alloc(&connection_slab, NULL);
+        if (connection == NULL) {
+            printf("Failed to allocate connection\n");
+            close(client_socket);
             continue;
         }
+        connection->socket = client_socket;
+        connection->received = 0;
+        connection->framed = false;
+        connection->frame = NULL;
 
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = connection;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            perror("Failed to watch client socket");
+            close(client_socket);
+            free_connection(connection);
+            continue;
+        }
         printf("New customer connected\n");
-        manager(client_socket); //handle the new customer
     }
+}
 
-    return 0;
+//read whatever part of the order has arrived and hand complete orders to the manager
+void handle_connection(int epoll_fd, Connection *connection, uint32_t events) {
+    if (connection->framed) {
+        if (events & (EPOLLHUP | EPOLLERR)) {
+            close_framed_connection(epoll_fd, connection); //reset, or dropped by the egress sender
+        } else {
+            read_frames(epoll_fd, connection);
+        }
+        return;
+    }
+
+    while (connection->received < ORDER_REQUEST_SIZE) {
+        ssize_t n = recv(connection->socket, connection->buffer + connection->received, ORDER_REQUEST_SIZE - connection->received, 0);
+        if (n > 0) {
+            connection->received += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return; //wait for the rest of the order
+        if (n < 0 && errno == EINTR) continue;
+
+        printf("Failed to receive customer coordinates\n");
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+        close(connection->socket);
+        free_connection(connection);
+        return;
+    }
+
+    int x, y;
+    memcpy(&x, connection->buffer, sizeof(int));
+    memcpy(&y, connection->buffer + sizeof(int), sizeof(int));
+    if ((uint32_t)x == PROTOCOL_MAGIC) {
+        start_framed_connection(epoll_fd, connection, (uint32_t)y); //the two ints were a hello
+        return;
+    }
+
+    //the order is complete, the egress sender writes its statuses from here on
+    set_nonblocking(connection->socket, 0);
+    int socket = connection->socket;
+    free_connection(connection);
+    SlabHandle handle = manager(socket, x, y, NULL); //handle the new customer
+    if (handle != 0) watch_hang_up(epoll_fd, socket, handle); //a refused order's socket is closed and left the epoll set
 }
 
-//routine for cooks to prepare and cook orders
+//answer the hello of a framed client and keep reading its frames
+void start_framed_connection(int epoll_fd, Connection *connection, uint32_t version) {
+    connection->frame = version == PROTOCOL_VERSION ? malloc(sizeof(FrameHeader) + MAX_FRAME_PAYLOAD) : NULL;
+    if (connection->frame == NULL) {
+        printf("Customer speaks protocol version %u, hanging up\n", version);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+        egress_hello(connection->socket, 0);
+        egress_close_socket(connection->socket);
+        free_connection(connection);
+        return;
+    }
+
+    connection->framed = true;
+    connection->frame_received = 0;
+    atomic_init(&connection->refs, 1);
+    atomic_init(&connection->hung_up, 0);
+    connection->notify_mask = SUBSCRIBE_FULL_MASK;
+    egress_hello(connection->socket, PROTOCOL_VERSION);
+    read_frames(epoll_fd, connection); //the first frames may have arrived with the hello
+}
+
+//read the frames of a framed connection and place the orders they carry
+void read_frames(int epoll_fd, Connection *connection) {
+    int frames = 0;
+    while (frames < MAX_FRAMES_PER_WAKEUP) {
+        if (connection->frame_received == 0 && stage_bound > 0 && stages_full()) return; //the ingress loop pauses the connection
+        size_t wanted = sizeof(FrameHeader);
+        if (connection->frame_received >= sizeof(FrameHeader)) {
+            FrameHeader header;
+            memcpy(&header, connection->frame, sizeof(header));
+            bool orders = header.type == FRAME_ORDERS && header.length <= MAX_FRAME_PAYLOAD && header.length % sizeof(OrderRequest) == 0;
+            bool subscribe = header.type == FRAME_SUBSCRIBE && header.length == sizeof(uint32_t);
+            if (!orders && !subscribe) {
+                printf("Malformed frame from customer, hanging up\n");
+                close_framed_connection(epoll_fd, connection);
+                return;
+            }
+            wanted += header.length;
+            if (connection->frame_received == wanted) {
+                unsigned char *payload = connection->frame + sizeof(FrameHeader);
+                if (subscribe) {
+                    uint32_t level;
+                    memcpy(&level, payload, sizeof(level));
+                    connection->notify_mask = subscription_mask(level);
+                    if (connection->notify_mask == 0) {
+                        printf("Customer asked for unknown subscription level %u, hanging up\n", level);
+                        close_framed_connection(epoll_fd, connection);
+                        return;
+                    }
+                }
+                OrderRequest *requests = (OrderRequest *)payload;
+                for (size_t i = 0; orders && i < header.length / sizeof(OrderRequest); i++) {
+                    manager(connection->socket, requests[i].x, requests[i].y, connection);
+                }
+                connection->frame_received = 0;
+                frames++;
+                continue;
+            }
+        }
+
+        ssize_t n = recv(connection->socket, connection->frame + connection->frame_received, wanted - connection->frame_received, 0);
+        if (n > 0) {
+            connection->frame_received += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return; //wait for the rest of the frame
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n == 0) {
+            end_framed_requests(epoll_fd, connection); //half-closed after its last request, it still reads statuses
+        } else {
+            close_framed_connection(epoll_fd, connection); //the client is gone, its orders in progress are dropped
+        }
+        return;
+    }
+}
+
+//stop reading a framed connection and drop the reference of the ingress loop
+void close_framed_connection(int epoll_fd, Connection *connection) {
+    atomic_store(&connection->hung_up, 1);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+    release_connection(connection);
+}
+
+//the client sent its last request: stop reading and drop the reference of the ingress loop, but keep its orders.
+//the socket stays watched for a reset or an egress drop through a handle, since the last order may free the connection
+void end_framed_requests(int epoll_fd, Connection *connection) {
+    struct epoll_event event;
+    event.events = EPOLLONESHOT; //EPOLLHUP and EPOLLERR are always reported
+    event.data.u64 = slab_handle(&connection_slab, connection) | CONNECTION_TAG;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->socket, &event);
+    release_connection(connection);
+}
+
+//drop a reference to a framed connection, the last one closes the socket after its queued statuses
+void release_connection(Connection *connection) {
+    if (atomic_fetch_sub(&connection->refs, 1) != 1) return;
+    egress_close_socket(connection->socket);
+    free_connection(connection);
+}
+
+//return a connection slot, a handle to it stops resolving
+void free_connection(Connection *connection) {
+    free(connection->frame);
+    slab_free(&connection_slab, connection);
+}
+
+//statuses a subscription level sends, 0 for an unknown level
+uint32_t subscription_mask(uint32_t level) {
+    switch (level) {
+        case SUBSCRIBE_FULL: return SUBSCRIBE_FULL_MASK;
+        case SUBSCRIBE_MILESTONES: return SUBSCRIBE_MILESTONES_MASK;
+        case SUBSCRIBE_FINAL: return SUBSCRIBE_FINAL_MASK;
+        default: return 0;
+    }
+}
+
+//keep watching the socket of a placed order so a disconnect is seen before the kitchen works on it.
+//only EPOLLHUP and EPOLLERR count: a FIN alone may be a client that half-closed after its order and still waits for statuses,
+//a reset or the egress sender giving up on the client raise them. The watch fires once; if a worker already closed
+//the socket the kernel dropped it and this fails harmlessly
+void watch_hang_up(int epoll_fd, int socket, SlabHandle handle) {
+    struct epoll_event event;
+    event.events = EPOLLONESHOT; //EPOLLHUP and EPOLLERR are always reported
+    event.data.u64 = handle | HANG_UP_TAG;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, socket, &event);
+}
+
+//cancel an order whose client hung up before a stage started working on it, returns true if it was dropped
+bool drop_hung_up_order(Order *order, bool saves_prep, bool saves_oven) {
+    if (!atomic_load(&order->hung_up) && (order->connection == NULL || !atomic_load(&order->connection->hung_up))) return false;
+
+    printf("%d th order canceled, client hung up.\n", order->order_id);
+    order->canceled_flag = 1;
+    cancel_order(order); //releases the order
+    atomic_fetch_add(&hung_up_orders, 1);
+    if (saves_prep) atomic_fetch_add(&saved_cook_ns, mean_work_ns(&prep_work_ns, &prep_work_count));
+    if (saves_oven) atomic_fetch_add(&saved_oven_ns, mean_work_ns(&cook_work_ns, &cook_work_count));
+    return true;
+}
+
+//mean duration of a kitchen kernel so far, used to estimate the work saved by dropping an order
+uint64_t mean_work_ns(atomic_uint_fast64_t *total, atomic_uint_fast64_t *count) {
+    uint64_t n = atomic_load(count);
+    return n == 0 ? 0 : atomic_load(total) / n;
+}
+
+//time an order should take from now on: the mean kitchen work so far plus the ride to its address
+uint64_t estimated_order_ns(Order *order) {
+    uint64_t kitchen_ns = mean_work_ns(&prep_work_ns, &prep_work_count) + mean_work_ns(&cook_work_ns, &cook_work_count);
+    return kitchen_ns + (uint64_t)calculate_delivery_time(order->x, order->y, delivery_speed) * 1000;
+}
+
+//time until a new order to (x, y) would be delivered given the orders ahead of it. Every stage works through
+//its backlog at the measured rate of its active workers, and the order reaches a stage no sooner than it left the one before
+uint64_t estimated_completion_ns(int x, int y) {
+    double prep_ns = mean_work_ns(&prep_work_ns, &prep_work_count);
+    double cook_ns = mean_work_ns(&cook_work_ns, &cook_work_count);
+    double travel_ns = (double)calculate_delivery_time(x, y, delivery_speed) * 1000;
+    double trip_ns = atomic_load(&route_count) > 0 ? mean_work_ns(&route_ns, &route_count) : 2 * travel_ns; //no round trip measured yet
+    int ovens = oven_pool_size < MAX_OVEN_SIZE ? oven_pool_size : MAX_OVEN_SIZE;
+
+    size_t preparing = preparation_depth();
+    size_t kitchen = preparing + sched_queue_depth(&cook_queue) + atomic_load(&ovens_cooking);
+    size_t waiting_pickup = kitchen + atomic_load(&ready_backlog);
+
+    double prepared = ((double)preparing / elastic_pool_size(&cook_scaling) + 1) * prep_ns;
+    double oven_free = (double)kitchen / ovens * cook_ns;
+    double ready = (prepared > oven_free ? prepared : oven_free) + cook_ns;
+    double courier_free = (double)waiting_pickup / ((double)elastic_pool_size(&courier_scaling) * MAX_DELIVERY_BAG) * trip_ns;
+    return (uint64_t)((ready > courier_free ? ready : courier_free) + travel_ns);
+}
+
+//routine for cooks to prepare orders and pass them to the oven stage
 void *cook_routine(void *arg) {
     Cook *cook = (Cook *)arg;
 
     while (1) {
-        pthread_mutex_lock(&order_mutex);
-
-        Order *order = dequeue_preparation(); //get the next order to prepare
-        while (order == NULL) {
-            pthread_cond_wait(&order_cond, &order_mutex);
-            order = dequeue_preparation();
+        Order *order;
+        if (!elastic_pool_active(&cook_scaling, cook->id)) {
+            //retired by the autoscaler: prepare what is left in the own queue, then park
+            order = dequeue_preparation_leftover(cook->id);
+            if (order == NULL) {
+                elastic_pool_park(&cook_scaling, cook->id);
+                continue;
+            }
+        } else {
+            order = dequeue_preparation_by(cook->id); //sleep until there is an order to prepare
         }
+        if (drop_hung_up_order(order, true, true)) continue; //nobody is waiting for it
 
         log_order_status(order, 1, cook->id); //log that the order is being prepared
-        order->status = 1;
-        if (send(order->client_socket, &order->status, sizeof(int), 0) == -1) {
-            printf("%d th order canceled.\n", order->order_id);
-            order->canceled_flag = 1;
-            cancel_order(order);
-            pthread_mutex_unlock(&order_mutex);
-            continue;
-        }
-        pthread_mutex_unlock(&order_mutex);
+        notify_status(order, 1);
+        trace_mark(&order->span, SPAN_PREP_START, cook->id);
+        uint64_t start_ns = monotonic_ns();
+        atomic_fetch_add(&prep_wait_ns, start_ns - order->received_ns);
+        atomic_fetch_add(&prep_wait_count, 1);
         simulate_computation_delay_prep(); //simulate preparation time
+        uint64_t work_ns = monotonic_ns() - start_ns;
+        atomic_fetch_add(&prep_work_ns, work_ns);
+        metrics_add_busy(cook->metrics, work_ns);
+        atomic_fetch_add(&prep_work_count, 1);
+        cook->prepared_orders++;
+        trace_mark(&order->span, SPAN_PREP_END, cook->id);
+        enqueue_cooking(order); //the cook is free for the next order while this one waits for an oven
+    }
+
+    return NULL;
+}
+
+//routine for oven workers to cook prepared orders, at most MAX_OVEN_SIZE at a time
+void *oven_routine(void *arg) {
+    OvenWorker *oven_worker = (OvenWorker *)arg;
+
+    while (1) {
+        //take a free oven before the order, so the order that gets it is the one the policy ranks first at that moment
         sem_wait(&oven_sem); //wait for an oven to become available
-        pthread_mutex_lock(&order_mutex);
-        log_order_status(order, 2, cook->id); //log that the order is being cooked
-        order->status = 2;
-        if (send(order->client_socket, &order->status, sizeof(int), 0) == -1) {
-            if (order->canceled_flag == 0) {
-                printf("%d th order canceled.\n", order->order_id);
-                order->canceled_flag = 1;
-                cancel_order(order);
-            }
-            pthread_mutex_unlock(&order_mutex);
-            sem_post(&oven_sem); //release the oven
+        Order *order = dequeue_cooking_wait(); //sleep until a prepared order is waiting
+        trace_mark(&order->span, SPAN_OVEN_TAKEN, oven_worker->id);
+        if (drop_hung_up_order(order, false, true)) { //the client left while the order waited for an oven
+            sem_post(&oven_sem);
             continue;
         }
-        pthread_mutex_unlock(&order_mutex);
+
+        log_order_status(order, 2, oven_worker->id); //log that the order is being cooked
+        notify_status(order, 2);
+        trace_mark(&order->span, SPAN_COOK_START, oven_worker->id);
+        atomic_fetch_add(&ovens_cooking, 1);
+        uint64_t start_ns = monotonic_ns();
         simulate_computation_delay_cook(); //simulate cooking time
+        uint64_t work_ns = monotonic_ns() - start_ns;
+        atomic_fetch_add(&cook_work_ns, work_ns);
+        metrics_add_busy(oven_worker->metrics, work_ns);
+        atomic_fetch_add(&cook_work_count, 1);
 
-        pthread_mutex_lock(&order_mutex);
-        log_order_status(order, 3, cook->id); //log that the order is ready for delivery
-        order->status = 3;
-        if (send(order->client_socket, &order->status, sizeof(int), 0) == -1) {
-            if (order->canceled_flag == 0) {
-                printf("%d th order canceled.\n", order->order_id);
-                order->canceled_flag = 1;
-                cancel_order(order);
-            }
-            pthread_mutex_unlock(&order_mutex);
-            sem_post(&oven_sem); //release the oven
-            continue;
-        }
-        enqueue_delivery(order); //add the order to the delivery queue
-        cook->prepared_orders++;
-        pthread_cond_signal(&delivery_cond); //signal delivery persons
-        pthread_mutex_unlock(&order_mutex);
+        log_order_status(order, 3, oven_worker->id); //log that the order is ready for delivery
+        notify_status(order, 3);
+        order->ready_ns = monotonic_ns();
+        trace_mark(&order->span, SPAN_READY, oven_worker->id);
+        atomic_fetch_add(&ready_backlog, 1);
+        atomic_fetch_sub(&ovens_cooking, 1);
+        enqueue_delivery(order); //add the order to the delivery queue, wakes a sleeping courier
+        oven_worker->cooked_orders++;
 
         sem_post(&oven_sem); //release the oven
     }
@@ -259,245 +1098,567 @@ void *cook_routine(void *arg) {
     return NULL;
 }
 
+//grow a pool when its backlog or wait is over the target, shrink it by one after it stayed well under for a while
+void scale_pool(ScaledPool *scaled, size_t backlog, uint64_t wait_ns, uint64_t count) {
+    int active = elastic_pool_size(scaled->pool);
+    double wait_ms = count > scaled->last_count ? (wait_ns - scaled->last_wait_ns) / 1e6 / (count - scaled->last_count) : 0;
+    scaled->last_wait_ns = wait_ns;
+    scaled->last_count = count;
+
+    int target = active;
+    if (backlog > (size_t)active * SCALE_BACKLOG_PER_WORKER || wait_ms > scale_target_ms) {
+        target = active + (active / 4 > 1 ? active / 4 : 1);
+        int needed = (int)(backlog / SCALE_BACKLOG_PER_WORKER); //catch up with a burst, at most doubling per interval
+        if (needed > target) target = needed < 2 * active ? needed : 2 * active;
+        scaled->calm_intervals = 0;
+    } else if (backlog == 0 && wait_ms < scale_target_ms / 4.0) {
+        if (++scaled->calm_intervals >= SCALE_CALM_INTERVALS) {
+            target = active - 1;
+            scaled->calm_intervals = 0;
+        }
+    } else {
+        scaled->calm_intervals = 0; //between the two thresholds, keep the size
+    }
+
+    int size = elastic_pool_resize(scaled->pool, target);
+    if (size != active) {
+        if (scaled->pool == &cook_scaling) shop_core_active_cooks(size);
+        printf("Autoscaler: %s %d -> %d (backlog %zu, mean wait %.2f ms)\n", scaled->name, active, size, backlog, wait_ms);
+    }
+}
+
+//watch the preparation queue and the ready orders and resize the cook and courier pools
+void *autoscaler_routine(void *arg) {
+    (void)arg;
+    ScaledPool cooks_scaled = {&cook_scaling, "cooks", 0, 0, 0};
+    ScaledPool couriers_scaled = {&courier_scaling, "couriers", 0, 0, 0};
+    struct timespec interval = {scale_interval_ms / 1000, (long)(scale_interval_ms % 1000) * 1000000};
+
+    while (1) {
+        nanosleep(&interval, NULL);
+        scale_pool(&cooks_scaled, preparation_depth(), atomic_load(&prep_wait_ns), atomic_load(&prep_wait_count));
+
+        uint64_t pickup_ns = 0, pickups = 0;
+        for (int i = 0; i < pickup_histogram_count; i++) {
+            pickup_ns += atomic_load_explicit(&pickup_histograms[i].sum, memory_order_relaxed);
+            pickups += atomic_load_explicit(&pickup_histograms[i].count, memory_order_relaxed);
+        }
+        scale_pool(&couriers_scaled, (size_t)ready_order_count() + stage_queue_depth(&delivery_queue), pickup_ns, pickups);
+    }
+
+    return NULL;
+}
+
+//CPUs of a pool: the given list, or every online CPU the ingress thread does not use
+int pool_cpus(const char *list, const cpu_set_t *online, const cpu_set_t *ingress, cpu_set_t *cpus) {
+    if (list != NULL) {
+        if (cpu_parse_list(list, cpus) < 0) {
+            printf("Invalid CPU list %s\n", list);
+            return -1;
+        }
+        cpu_set_t offline;
+        CPU_XOR(&offline, cpus, online);
+        CPU_AND(&offline, &offline, cpus);
+        if (CPU_COUNT(&offline) > 0) {
+            printf("CPU list %s contains CPUs that are not online\n", list);
+            return -1;
+        }
+        return 0;
+    }
+    CPU_XOR(cpus, online, ingress); //ingress is a subset of online
+    if (CPU_COUNT(cpus) == 0) *cpus = *online; //nothing left, share with the ingress thread
+    return 0;
+}
+
+//read the CPU topology, pin the calling thread to the ingress CPUs and plan the kitchen and delivery pools
+int setup_placement(void) {
+    cpu_set_t online, ingress, kitchen, delivery;
+    if (cpu_topology_load() < 0 || cpu_online(&online) < 0) {
+        printf("Failed to read the CPU topology from sysfs\n");
+        return -1;
+    }
+
+    CPU_ZERO(&ingress);
+    if (ingress_cpus != NULL) {
+        if (pool_cpus(ingress_cpus, &online, &ingress, &ingress) < 0) return -1;
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &ingress) != 0) {
+            printf("Failed to pin the ingress thread to CPUs %s\n", ingress_cpus);
+            return -1;
+        }
+    }
+    if (pool_cpus(kitchen_cpus, &online, &ingress, &kitchen) < 0 || pool_cpus(delivery_cpus, &online, &ingress, &delivery) < 0) return -1;
+    if (cpu_pool_init(&kitchen_pool, "kitchen", &kitchen, placement_policy) < 0 || cpu_pool_init(&delivery_pool, "delivery", &delivery, placement_policy) < 0) {
+        printf("Failed to plan the thread placement\n");
+        return -1;
+    }
+
+    char list[256];
+    cpu_format_list(&online, list, sizeof(list));
+    printf("Thread placement %s, online CPUs %s\n", cpu_policy_name(placement_policy), list);
+    if (ingress_cpus != NULL) {
+        cpu_format_list(&ingress, list, sizeof(list));
+        printf("Placing the ingress loop and the egress, log and metrics threads on CPUs %s\n", list);
+    }
+    cpu_pool_print(&kitchen_pool, cook_pool_size + oven_pool_size);
+    int delivery_threads = wheel_engine ? (wheel_threads < delivery_pool_size ? wheel_threads : delivery_pool_size) : delivery_pool_size;
+    cpu_pool_print(&delivery_pool, delivery_threads);
+    return 0;
+}
+
+//pin the index-th thread of a pool when a placement was asked for
+void place_thread(CpuPool *pool, pthread_t thread, int index) {
+    if (!placement_enabled) return;
+    if (cpu_pool_pin(pool, thread, index) < 0) printf("Failed to pin %s thread %d\n", pool->name, index);
+}
+
+//create the couriers and the threads that drive them
+int start_delivery_engine(int delivery_speed) {
+    delivery_persons = aligned_alloc(CACHE_LINE_SIZE, delivery_pool_size * sizeof(DeliveryPerson)); //allocate memory for delivery persons
+    if (wheel_threads > delivery_pool_size) wheel_threads = delivery_pool_size;
+    pickup_histogram_count = wheel_engine ? wheel_threads : delivery_pool_size;
+    pickup_histograms = malloc(pickup_histogram_count * sizeof(LatencyHistogram));
+    if (delivery_persons == NULL || pickup_histograms == NULL) return -1;
+    for (int i = 0; i < pickup_histogram_count; i++) histogram_init(&pickup_histograms[i]);
+
+    for (int i = 0; i < delivery_pool_size; i++) {
+        delivery_persons[i].id = i;
+        delivery_persons[i].speed = delivery_speed;
+        delivery_persons[i].bag_count = 0;
+        delivery_persons[i].delivered_orders = 0;
+        delivery_persons[i].pickup_latency = &pickup_histograms[wheel_engine ? i % wheel_threads : i];
+        delivery_persons[i].timer.owner = &delivery_persons[i];
+        delivery_persons[i].metrics = metrics_worker("courier", i);
+    }
+
+    if (!wheel_engine) {
+        for (int i = 0; i < delivery_pool_size; i++) {
+            if (pthread_create(&delivery_persons[i].thread, NULL, delivery_routine, &delivery_persons[i]) != 0) return -1;
+            place_thread(&delivery_pool, delivery_persons[i].thread, i);
+        }
+        return 0;
+    }
+
+    //couriers are split round robin over the engine threads and all start idle at the shop
+    courier_engines = aligned_alloc(CACHE_LINE_SIZE, wheel_threads * sizeof(CourierEngine));
+    if (courier_engines == NULL) return -1;
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < wheel_threads; i++) {
+        CourierEngine *engine = &courier_engines[i];
+        engine->id = i;
+        engine->idle_count = 0;
+        engine->idle = malloc((delivery_pool_size / wheel_threads + 1) * sizeof(DeliveryPerson *));
+        if (engine->idle == NULL) return -1;
+        timer_wheel_init(&engine->wheel, now, (uint64_t)wheel_tick_us * 1000);
+    }
+    for (int i = 0; i < delivery_pool_size; i++) {
+        CourierEngine *engine = &courier_engines[i % wheel_threads];
+        engine->idle[engine->idle_count++] = &delivery_persons[i];
+    }
+    for (int i = 0; i < wheel_threads; i++) {
+        if (pthread_create(&courier_engines[i].thread, NULL, courier_engine_routine, &courier_engines[i]) != 0) return -1;
+        place_thread(&delivery_pool, courier_engines[i].thread, i);
+    }
+    printf("Driving %d couriers with %d wheel engine threads\n", delivery_pool_size, wheel_threads);
+    return 0;
+}
+
+//gauges read by the metrics socket on every scrape
+double prep_queue_depth(void) {
+    return preparation_depth();
+}
+
+double cook_queue_depth(void) {
+    return sched_queue_depth(&cook_queue);
+}
+
+double delivery_queue_depth(void) {
+    return stage_queue_depth(&delivery_queue);
+}
+
+double ready_order_count(void) {
+    pthread_mutex_lock(&delivery_mutex);
+    size_t count = dispatch_count(&ready_grid);
+    pthread_mutex_unlock(&delivery_mutex);
+    return count;
+}
+
+double oven_occupancy(void) {
+    return atomic_load(&ovens_cooking); //idle oven workers hold a slot while they wait for an order
+}
+
+double live_order_count(void) {
+    return slab_live(&order_slab);
+}
+
+double busy_order_count(void) {
+    return atomic_load(&busy_orders);
+}
+
+double ingress_paused_flag(void) {
+    return ingress_paused;
+}
+
+//work stealing counters summed over all cooks
+void steal_totals(uint64_t *own, uint64_t *stolen, uint64_t *failed) {
+    *own = *stolen = *failed = 0;
+    for (int i = 0; i < prep_deques.count; i++) {
+        *own += atomic_load(&prep_deques.counters[i].local);
+        *stolen += atomic_load(&prep_deques.counters[i].stolen);
+        *failed += atomic_load(&prep_deques.counters[i].failed_steals);
+    }
+}
+
+double own_prep_orders(void) {
+    uint64_t own, stolen, failed;
+    steal_totals(&own, &stolen, &failed);
+    return own;
+}
+
+double stolen_prep_orders(void) {
+    uint64_t own, stolen, failed;
+    steal_totals(&own, &stolen, &failed);
+    return stolen;
+}
+
+double failed_prep_steals(void) {
+    uint64_t own, stolen, failed;
+    steal_totals(&own, &stolen, &failed);
+    return failed;
+}
+
+//register the gauges and open the stats socket
+int start_metrics(int port) {
+    metrics_gauge("pide_queue_depth", "queue=\"prep\"", "Orders waiting in a stage queue", prep_queue_depth);
+    metrics_gauge("pide_queue_depth", "queue=\"cook\"", "Orders waiting in a stage queue", cook_queue_depth);
+    metrics_gauge("pide_queue_depth", "queue=\"delivery\"", "Orders waiting in a stage queue", delivery_queue_depth);
+    metrics_gauge("pide_ready_orders", NULL, "Ready orders waiting for a courier", ready_order_count);
+    metrics_gauge("pide_oven_occupancy", NULL, "Oven slots in use", oven_occupancy);
+    metrics_gauge("pide_live_orders", NULL, "Orders in progress", live_order_count);
+    metrics_gauge("pide_busy_orders", NULL, "Orders turned away with the busy status", busy_order_count);
+    metrics_gauge("pide_ingress_paused", NULL, "1 while a full stage keeps the ingress from reading orders", ingress_paused_flag);
+    if (work_stealing) {
+        metrics_gauge("pide_prep_orders_taken", "source=\"own\"", "Orders cooks took from their own queue or stole", own_prep_orders);
+        metrics_gauge("pide_prep_orders_taken", "source=\"stolen\"", "Orders cooks took from their own queue or stole", stolen_prep_orders);
+        metrics_gauge("pide_prep_failed_steals", NULL, "Empty cook queues probed while looking for orders", failed_prep_steals);
+    }
+    return metrics_open(port);
+}
+
 // Routine for delivery persons to deliver orders
 void *delivery_routine(void *arg) {
     DeliveryPerson *delivery_person = (DeliveryPerson *)arg;
 
     while (1) {
-        pthread_mutex_lock(&order_mutex);
+        elastic_pool_park(&courier_scaling, delivery_person->id); //returns at once unless the autoscaler retired the courier
 
-        //fill the delivery bag with orders
-        while (delivery_person->bag_count < MAX_DELIVERY_BAG && delivery_queue_start != delivery_queue_end) {
-            Order *order = dequeue_delivery();
-            if (order != NULL) {
-                delivery_person->bag[delivery_person->bag_count++] = order;
-                log_order_status(order, 4, delivery_person->id); //log that the order is out for delivery
-                order->status = 4;
-                if (send(order->client_socket, &order->status, sizeof(int), 0) == -1) {
-                    if (order->canceled_flag == 0) {
-                        printf("%d th order canceled.\n", order->order_id);
-                        order->canceled_flag = 1;
-                        cancel_order(order);
-                    }
-                    pthread_mutex_unlock(&order_mutex);
-                    continue;
-                }
-            }
-        }
+        //fill the delivery bag with the oldest ready order and the ready orders nearest to it
+        void *batch[MAX_DELIVERY_BAG];
+        int batch_count = take_delivery_batch(batch); //sleeps until a bag is worth taking
+        load_bag(delivery_person, batch, batch_count, monotonic_ns());
 
         //if there are orders in the bag deliver them
         if (delivery_person->bag_count > 0) {
-            pthread_mutex_unlock(&order_mutex);
-            for (int i = 0; i < delivery_person->bag_count; i++) {
-                Order *order = delivery_person->bag[i];
-                int delivery_time = calculate_delivery_time(order->x, order->y, delivery_person->speed); //calculate delivery time
-                //sleep(delivery_time);
-                usleep(delivery_time);
-                pthread_mutex_lock(&order_mutex);
-                log_order_status(order, 5, delivery_person->id); //log that the order was delivered
-                order->status = 5;
-                if (send(order->client_socket, &order->status, sizeof(int), 0) == -1) {
-                    if (order->canceled_flag == 0) {
-                        printf("%d th order canceled.\n", order->order_id);
-                        order->canceled_flag = 1;
-                        cancel_order(order);
-                    }
-                    pthread_mutex_unlock(&order_mutex);
-                    continue;
-                }
-                delivered_count++;
-                delivery_person->delivered_orders++;
-                if (delivered_count == order_count) {
-                    notify_clients_all_orders_completed(); //notify all clients if all orders are delivered
-                }
-                pthread_mutex_unlock(&order_mutex);
-            }
-            delivery_person->bag_count = 0; //empty the bag
-        } else {
-            pthread_mutex_unlock(&order_mutex);
-            sleep(1); //sleep for before checking again
+            uint64_t start_ns = monotonic_ns();
+            deliver_bag(delivery_person);
+            uint64_t trip_ns = monotonic_ns() - start_ns;
+            metrics_add_busy(delivery_person->metrics, trip_ns);
+            atomic_fetch_add(&route_ns, trip_ns);
+            atomic_fetch_add(&route_count, 1);
         }
     }
 
     return NULL;
 }
 
-// Handle a new customer order
-void manager(int socket) {
-    int x, y;
-    if (recv(socket, &x, sizeof(int), 0) <= 0 || recv(socket, &y, sizeof(int), 0) <= 0) {
-        printf("Failed to receive customer coordinates\n");
-        close(socket);
-        return;
+//put a batch into the bag, tell the clients their orders are out for delivery and plan the route
+void load_bag(DeliveryPerson *delivery_person, void **batch, int count, uint64_t pickup_ns) {
+    atomic_fetch_sub(&ready_backlog, count);
+    for (int i = 0; i < count; i++) {
+        Order *order = batch[i];
+        if (drop_hung_up_order(order, false, false)) continue; //do not ride to an empty house
+        histogram_record(delivery_person->pickup_latency, pickup_ns - order->ready_ns);
+        log_order_status(order, 4, delivery_person->id); //log that the order is out for delivery
+        notify_status(order, 4);
+        trace_mark(&order->span, SPAN_OUT, delivery_person->id);
+        delivery_person->bag[delivery_person->bag_count++] = order;
+    }
+
+    //plan a short round trip through the addresses in the bag
+    int xs[MAX_DELIVERY_BAG], ys[MAX_DELIVERY_BAG];
+    for (int i = 0; i < delivery_person->bag_count; i++) {
+        xs[i] = delivery_person->bag[i]->x;
+        ys[i] = delivery_person->bag[i]->y;
     }
+    plan_route(delivery_person->bag_count, xs, ys, delivery_person->route);
+}
 
+//hand an order to its client at the end of a leg
+void complete_delivery(DeliveryPerson *delivery_person, Order *order) {
+    log_order_status(order, 5, delivery_person->id); //log that the order was delivered
+    notify_status(order, 5);
+    trace_mark(&order->span, SPAN_DELIVERED, delivery_person->id);
+    finish_order(order); //the slot is free for a new order before the completion check
+    delivery_person->delivered_orders++;
     pthread_mutex_lock(&order_mutex);
+    delivered_count++;
+    if (delivered_count == order_count) {
+        notify_clients_all_orders_completed(); //notify all clients if all orders are delivered
+    }
+    pthread_mutex_unlock(&order_mutex);
+}
 
-    if (order_count < MAX_ORDERS) {
-        orders[order_count].order_id = order_count + 1;
-        orders[order_count].x = x;
-        orders[order_count].y = y;
-        orders[order_count].order_time = time(NULL);
-        orders[order_count].status = 0; //order received
-        orders[order_count].client_socket = socket;
-        orders[order_count].canceled_flag = 0; //flag not canceled
-        log_order_status(&orders[order_count], 0, -1);
-        enqueue_preparation(&orders[order_count]); //add order to preparation queue
-        order_count++;
-        pthread_cond_signal(&order_cond); //signal cooks
-    } else {
-        printf("Maximum orders reached. Cannot accept new order.\n");
-        close(socket);
+//ride the planned round trip, delivering each order on arrival
+void deliver_bag(DeliveryPerson *delivery_person) {
+    int x = 0, y = 0; //courier starts at the shop
+    for (int i = 0; i < delivery_person->bag_count; i++) {
+        Order *order = delivery_person->bag[delivery_person->route[i]];
+        usleep(calculate_leg_time(x, y, order->x, order->y, delivery_person->speed)); //ride to the next address
+        x = order->x;
+        y = order->y;
+        complete_delivery(delivery_person, order);
     }
+    usleep(calculate_leg_time(x, y, 0, 0, delivery_person->speed)); //ride back to the shop
+    delivery_person->bag_count = 0; //empty the bag
+}
 
-    pthread_mutex_unlock(&order_mutex);
+//move ready orders from the delivery queue into the grid, delivery_mutex must be held
+void index_ready_orders(Order *first) {
+    Order *ready = first != NULL ? first : dequeue_delivery();
+    while (ready != NULL) {
+        if (dispatch_insert(&ready_grid, ready, ready->x, ready->y) < 0) {
+            printf("Failed to index order %d for delivery\n", ready->order_id);
+        }
+        ready = dequeue_delivery();
+    }
 }
 
-//log the status of an order
-void log_order_status(Order *order, int status, int thread_id) {
-    const char *status_str;
-    switch (status) {
-        case 0:
-            status_str = "Order received";
-            break;
-        case 1:
-            status_str = "Preparing";
-            break;
-        case 2:
-            fprintf(log_file, "Order for client %d is get order into aparatus\n", order->order_id);
-            fflush(log_file);
-            status_str = "Cooking";
-            break;
-        case 3:
-            fprintf(log_file, "Order for client %d is get order into aparatus\n", order->order_id);
-            fflush(log_file);
-            status_str = "Ready for delivery";
-            break;
-        case 4:
-            status_str = "Out for delivery";
-            break;
-        case 5:
-            status_str = "Delivered";
-            break;
-        case 6:
-            status_str = "Canceled";
-            break;
-        default:
-            status_str = "Unknown status";
-    }
-
-    fprintf(log_file, "Order %d at (%d, %d): %s by thread %d at %s", order->order_id, order->x, order->y, status_str, thread_id, ctime(&order->order_time));
-    fflush(log_file);
-}
-
-//calculate the delivery time 
-int calculate_delivery_time(int x, int y, int speed) {
-    double distance = sqrt(x * x + y * y);
-    return (int)(distance / speed * 60); // Convert distance to time based on speed
-}
-
-//enqueue an order for preparation
-void enqueue_preparation(Order *order) {
-    prep_queue[prep_queue_end++] = order;
-    if (prep_queue_end == MAX_ORDERS) prep_queue_end = 0;
-}
-
-//dequeue an order for preparation
-Order *dequeue_preparation() {
-    if (prep_queue_start == prep_queue_end) return NULL;
-    Order *order = prep_queue[prep_queue_start++];
-    if (prep_queue_start == MAX_ORDERS) prep_queue_start = 0;
-    return order;
-}
-
-//enqueue an order for cooking
-void enqueue_cooking(Order *order) {
-    cook_queue[cook_queue_end++] = order;
-    if (cook_queue_end == MAX_ORDERS) cook_queue_end = 0;
-}
-
-//dequeue an order for cooking
-Order *dequeue_cooking() {
-    if (cook_queue_start == cook_queue_end) return NULL;
-    Order *order = cook_queue[cook_queue_start++];
-    if (cook_queue_start == MAX_ORDERS) cook_queue_start = 0;
-    return order;
-}
-
-//enqueue an order for delivery
-void enqueue_delivery(Order *order) {
-    delivery_queue[delivery_queue_end++] = order;
-    if (delivery_queue_end == MAX_ORDERS) delivery_queue_end = 0;
-}
-
-//dequeue an order for delivery
-Order *dequeue_delivery() {
-    if (delivery_queue_start == delivery_queue_end) return NULL;
-    Order *order = delivery_queue[delivery_queue_start++];
-    if (delivery_queue_start == MAX_ORDERS) delivery_queue_start = 0;
-    return order;
-}
-
-//simulate a delay for preparation(30 a 40)
-void simulate_computation_delay_prep() {
-    int n = 30, m = 40;
-    double complex matrix[30][40];
-    double complex result[30][30];
-
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < m; j++) {
-            matrix[i][j] = rand() / (double)RAND_MAX + I * (rand() / (double)RAND_MAX);
-        }
-    }
-
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            result[i][j] = 0;
-            for (int k = 0; k < m; k++) {
-                result[i][j] += conj(matrix[i][k]) * matrix[j][k];
-            }
+//take a bag if one is worth taking: either a full bag is ready, or the oldest ready order
+//has already waited bag_wait_ms for more orders to join it. Otherwise returns 0 with the
+//queue snapshot to sleep on and how long to sleep at most.
+int try_take_delivery_batch(void **batch, uint32_t *watched, uint64_t *timeout_ns) {
+    uint64_t bag_wait_ns = (uint64_t)bag_wait_ms * 1000000;
+
+    pthread_mutex_lock(&delivery_mutex);
+    *watched = stage_queue_watch(&delivery_queue); //before checking, so no wakeup is missed
+    index_ready_orders(NULL);
+    size_t waiting = dispatch_count(&ready_grid);
+    *timeout_ns = STAGE_QUEUE_FOREVER;
+    if (waiting > 0 && waiting < MAX_DELIVERY_BAG) {
+        Order *oldest = dispatch_oldest(&ready_grid);
+        uint64_t waited = monotonic_ns() - oldest->ready_ns;
+        if (waited < bag_wait_ns) {
+            *timeout_ns = bag_wait_ns - waited;
+            waiting = 0; //keep waiting for the bag to fill
         }
     }
+    if (waiting == 0) {
+        pthread_mutex_unlock(&delivery_mutex);
+        return 0;
+    }
+
+    int count = dispatch_take_batch(&ready_grid, batch, MAX_DELIVERY_BAG, bag_radius);
+    if (dispatch_count(&ready_grid) > 0) stage_queue_notify(&delivery_queue); //let an idle courier take the rest
+    pthread_mutex_unlock(&delivery_mutex);
+    return count;
 }
 
-//simulate a delay for cooking half of it (15 e 40)
-void simulate_computation_delay_cook() {
-    int n = 15, m = 40;
-    double complex matrix[15][40];
-    double complex result[15][15];
+//sleep until a bag is worth taking and take it
+int take_delivery_batch(void **batch) {
+    while (1) {
+        uint32_t watched;
+        uint64_t timeout_ns;
+        int count = try_take_delivery_batch(batch, &watched, &timeout_ns);
+        if (count > 0) return count;
 
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < m; j++) {
-            matrix[i][j] = rand() / (double)RAND_MAX + I * (rand() / (double)RAND_MAX);
+        Order *ready = order_from_queue_item(stage_queue_pop_timed(&delivery_queue, watched, timeout_ns));
+        if (ready != NULL) {
+            pthread_mutex_lock(&delivery_mutex);
+            index_ready_orders(ready);
+            pthread_mutex_unlock(&delivery_mutex);
         }
     }
+}
+
+//routine of a wheel engine thread: couriers are state machines and every leg of a route is a timer
+void *courier_engine_routine(void *arg) {
+    CourierEngine *engine = (CourierEngine *)arg;
 
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            result[i][j] = 0;
-            for (int k = 0; k < m; k++) {
-                result[i][j] += conj(matrix[i][k]) * matrix[j][k];
+    while (1) {
+        uint64_t now = monotonic_ns();
+        TimerEntry *timer = timer_wheel_advance(&engine->wheel, now);
+        while (timer != NULL) {
+            TimerEntry *next = timer->next; //the courier may put its timer back into the wheel
+            courier_arrived(engine, timer->owner, now);
+            timer = next;
+        }
+
+        //give bags to idle couriers while there are orders worth taking
+        uint32_t watched = 0;
+        uint64_t batch_timeout = STAGE_QUEUE_FOREVER;
+        while (engine->idle_count > 0) {
+            void *batch[MAX_DELIVERY_BAG];
+            int count = try_take_delivery_batch(batch, &watched, &batch_timeout);
+            if (count == 0) break;
+            now = monotonic_ns(); //orders in the batch may have become ready after the wheel advanced
+            start_route(engine, engine->idle[--engine->idle_count], batch, count, now);
+        }
+
+        //sleep until the next arrival, or until new orders are ready if a courier is idle
+        uint64_t next_expiry = timer_wheel_next_expiry(&engine->wheel);
+        now = monotonic_ns();
+        uint64_t timeout = next_expiry == UINT64_MAX ? STAGE_QUEUE_FOREVER : next_expiry > now ? next_expiry - now : 0;
+        if (engine->idle_count > 0) {
+            if (batch_timeout < timeout) timeout = batch_timeout;
+            Order *ready = order_from_queue_item(stage_queue_pop_timed(&delivery_queue, watched, timeout));
+            if (ready != NULL) {
+                pthread_mutex_lock(&delivery_mutex);
+                index_ready_orders(ready);
+                pthread_mutex_unlock(&delivery_mutex);
             }
+        } else if (timeout > 0 && timeout != STAGE_QUEUE_FOREVER) {
+            struct timespec pause = {timeout / 1000000000, timeout % 1000000000};
+            nanosleep(&pause, NULL);
         }
     }
+
+    return NULL;
+}
+
+//load a batch into an idle courier and send it on its first leg
+void start_route(CourierEngine *engine, DeliveryPerson *delivery_person, void **batch, int count, uint64_t now) {
+    load_bag(delivery_person, batch, count, now);
+    if (delivery_person->bag_count == 0) { //every order of the batch was canceled
+        engine->idle[engine->idle_count++] = delivery_person;
+        return;
+    }
+    delivery_person->next_stop = 0;
+    delivery_person->route_start_ns = now;
+    delivery_person->x = 0; //courier starts at the shop
+    delivery_person->y = 0;
+    schedule_next_leg(engine, delivery_person, now);
+}
+
+//set the arrival timer for the next address, or for the shop after the last one
+void schedule_next_leg(CourierEngine *engine, DeliveryPerson *delivery_person, uint64_t now) {
+    int to_x = 0, to_y = 0;
+    if (delivery_person->next_stop < delivery_person->bag_count) {
+        Order *order = delivery_person->bag[delivery_person->route[delivery_person->next_stop]];
+        to_x = order->x;
+        to_y = order->y;
+    }
+    uint64_t leg_ns = (uint64_t)calculate_leg_time(delivery_person->x, delivery_person->y, to_x, to_y, delivery_person->speed) * 1000;
+    timer_wheel_add(&engine->wheel, &delivery_person->timer, now + leg_ns);
+}
+
+//timer event: the courier reached the next address of its route or is back at the shop
+void courier_arrived(CourierEngine *engine, DeliveryPerson *delivery_person, uint64_t now) {
+    if (delivery_person->next_stop < delivery_person->bag_count) {
+        Order *order = delivery_person->bag[delivery_person->route[delivery_person->next_stop++]];
+        delivery_person->x = order->x;
+        delivery_person->y = order->y;
+        complete_delivery(delivery_person, order);
+        schedule_next_leg(engine, delivery_person, now);
+    } else {
+        delivery_person->bag_count = 0; //empty the bag
+        metrics_add_busy(delivery_person->metrics, now - delivery_person->route_start_ns);
+        atomic_fetch_add(&route_ns, now - delivery_person->route_start_ns);
+        atomic_fetch_add(&route_count, 1);
+        engine->idle[engine->idle_count++] = delivery_person;
+    }
+}
+
+// Handle a new customer order whose coordinates were read by the ingress loop, returns its handle or 0 if it was refused
+SlabHandle manager(int socket, int x, int y, Connection *connection) {
+    SlabHandle handle = 0;
+    if (sla_ms > 0 && estimated_completion_ns(x, y) > (uint64_t)sla_ms * 1000000) {
+        refuse_order(socket, connection); //better a fast no than a late pide
+        return 0;
+    }
+    pthread_mutex_lock(&order_mutex);
+
+    Order *order = slab_alloc(&order_slab, &handle); //zeroed slot, no allocation unless the slab has to grow
+    if (order != NULL) {
+        order->order_id = order_count + 1;
+        order->x = x;
+        order->y = y;
+        order->order_time = time(NULL);
+        order->status = 0; //order received
+        order->client_socket = socket;
+        order->canceled_flag = 0; //flag not canceled
+        order->handle = handle;
+        order->connection = connection;
+        order->notify_mask = connection != NULL ? connection->notify_mask : SUBSCRIBE_FULL_MASK; //legacy clients get every status
+        order->received_ns = monotonic_ns();
+        if (sched_policy != SCHEDULE_FIFO) order->sched_key = sched_key(sched_policy, order->received_ns, estimated_order_ns(order));
+        log_order_status(order, 0, -1);
+        trace_mark(&order->span, SPAN_RECEIVED, -1);
+        if (connection != NULL) {
+            atomic_fetch_add(&connection->refs, 1);
+            egress_frame_status(socket, order->order_id, 0); //tells a framed client the id of its request
+        }
+        order_count++;
+        enqueue_preparation(order); //add order to preparation queue, wakes a sleeping cook
+    } else {
+        printf("Maximum orders in progress reached. Cannot accept new order.\n");
+        refuse_order(socket, connection);
+    }
+
+    pthread_mutex_unlock(&order_mutex);
+    return handle;
+}
+
+//answer an order the shop cannot take with the busy status. A legacy socket is closed at once, no status of it is queued yet
+void refuse_order(int socket, Connection *connection) {
+    atomic_fetch_add(&busy_orders, 1);
+    if (connection != NULL) {
+        egress_frame_status(socket, 0, 7); //the connection stays open for its other orders
+    } else {
+        int busy_status = 7;
+        send(socket, &busy_status, sizeof(int), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(socket);
+    }
 }
 
 //notify all clients that all orders are completed
 void notify_clients_all_orders_completed() {
-    for (int i = 0; i < order_count; i++) {
-        if (orders[i].client_socket != -1) {
-            close(orders[i].client_socket);
+    for (uint32_t i = 0; i < slab_capacity(&order_slab); i++) {
+        Order *order = slab_at(&order_slab, i);
+        if (order != NULL && order->connection == NULL && order->client_socket != -1) {
+            egress_close_socket(order->client_socket);
+            order->client_socket = -1;
         }
     }
 }
 
-//cancel an order and update its status
+//cancel an order, update its status and release it
 void cancel_order(Order *order) {
-    order->status = 6;
     log_order_status(order, 6, -1);
-    if (send(order->client_socket, &order->status, sizeof(int), 0) == -1) {
-        close(order->client_socket);
-        order->client_socket = -1;
+    notify_status(order, 6);
+    finish_order(order);
+}
+
+//close the connection of a delivered or canceled order and recycle its slot, the order must not be used afterwards
+void finish_order(Order *order) {
+    trace_order(&order->span, order->order_id, order->x, order->y, order->status);
+    if (order->connection != NULL) {
+        release_connection(order->connection);
+    } else if (order->client_socket != -1) {
+        egress_close_socket(order->client_socket); //after the statuses queued before
+    }
+    slab_free(&order_slab, order);
+}
+
+//update the status of an order and queue it for the client if it subscribed to it
+void notify_status(Order *order, int status) {
+    order->status = status;
+    if (!(order->notify_mask & STATUS_BIT(status))) {
+        atomic_fetch_add_explicit(&unsubscribed_statuses, 1, memory_order_relaxed); //no socket write for it
+        return;
+    }
+    if (order->connection != NULL) {
+        egress_frame_status(order->client_socket, order->order_id, status);
+    } else {
+        egress_status(order->client_socket, status);
     }
 }
 
@@ -515,6 +1676,18 @@ void print_most_efficient_workers() {
         printf("Most efficient cook: Cook %d with %d orders prepared\n", most_efficient_cook_id, max_prepared_orders);
     }
 
+    int max_cooked_orders = 0;
+    int most_efficient_oven_worker_id = -1;
+    for (int i = 0; i < oven_pool_size; i++) {
+        if (oven_workers[i].cooked_orders > max_cooked_orders) {
+            max_cooked_orders = oven_workers[i].cooked_orders;
+            most_efficient_oven_worker_id = oven_workers[i].id;
+        }
+    }
+    if (most_efficient_oven_worker_id != -1) {
+        printf("Most efficient oven worker: Oven Worker %d with %d orders cooked\n", most_efficient_oven_worker_id, max_cooked_orders);
+    }
+
     int max_delivered_orders = 0;
     int most_efficient_delivery_person_id = -1;
     for (int i = 0; i < delivery_pool_size; i++) {
@@ -526,4 +1699,65 @@ void print_most_efficient_workers() {
     if (most_efficient_delivery_person_id != -1) {
         printf("Most efficient delivery person: Delivery Person %d with %d orders delivered\n", most_efficient_delivery_person_id, max_delivered_orders);
     }
-}
\ No newline at end of file
+}
+
+//print how long ready orders waited for a courier
+void print_pickup_latency() {
+    static LatencyHistogram pickup_latency;
+    histogram_init(&pickup_latency);
+    for (int i = 0; i < pickup_histogram_count; i++) histogram_merge(&pickup_latency, &pickup_histograms[i]);
+    if (atomic_load(&pickup_latency.count) == 0) return;
+
+    printf("Ready to pickup latency over %llu orders: mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           (unsigned long long)atomic_load(&pickup_latency.count), histogram_mean(&pickup_latency) / 1e6,
+           histogram_percentile(&pickup_latency, 50) / 1e6, histogram_percentile(&pickup_latency, 99) / 1e6,
+           atomic_load(&pickup_latency.max) / 1e6);
+}
+
+//print the kitchen work that was skipped because clients hung up before their orders were made
+void print_cancellation_savings() {
+    uint64_t dropped = atomic_load(&hung_up_orders);
+    if (dropped == 0) return;
+
+    printf("Dropped %llu orders of disconnected clients, saved %.3f cook-seconds and %.3f oven-slot seconds\n",
+           (unsigned long long)dropped, atomic_load(&saved_cook_ns) / 1e9, atomic_load(&saved_oven_ns) / 1e9);
+}
+
+//print how the cooks shared the preparation work
+void print_work_stealing() {
+    if (!work_stealing) return;
+    uint64_t own, stolen, failed;
+    steal_totals(&own, &stolen, &failed);
+    if (own + stolen == 0) return;
+
+    int fewest = cooks[0].prepared_orders, most = cooks[0].prepared_orders;
+    for (int i = 1; i < cook_pool_size; i++) {
+        if (cooks[i].prepared_orders < fewest) fewest = cooks[i].prepared_orders;
+        if (cooks[i].prepared_orders > most) most = cooks[i].prepared_orders;
+    }
+    printf("Cooks took %llu orders from their own queue and stole %llu (%.1f%%), probing %llu empty queues; each cook prepared between %d and %d orders\n",
+           (unsigned long long)own, (unsigned long long)stolen, 100.0 * stolen / (own + stolen), (unsigned long long)failed, fewest, most);
+}
+
+//print how many orders were turned away and how long the ingress waited for the stages to drain
+void print_admission() {
+    uint64_t busy = atomic_load(&busy_orders);
+    if (busy > 0) printf("Turned away %llu orders with the busy status\n", (unsigned long long)busy);
+    if (ingress_paused) paused_ns += monotonic_ns() - pause_start_ns;
+    if (ingress_pauses > 0) {
+        printf("Ingress paused %llu times for %.3f s in total while a stage held %d orders\n", (unsigned long long)ingress_pauses,
+               paused_ns / 1e9, stage_bound);
+    }
+}
+
+//print how many system calls the status egress needed
+void print_egress_stats() {
+    uint64_t statuses, syscalls;
+    egress_stats(&statuses, &syscalls);
+    if (statuses == 0) return;
+
+    printf("Status egress (%s) wrote %llu statuses with %llu system calls, %.2f per status\n", egress_mode_name(),
+           (unsigned long long)statuses, (unsigned long long)syscalls, (double)syscalls / statuses);
+    uint64_t skipped = atomic_load(&unsubscribed_statuses);
+    if (skipped > 0) printf("Skipped %llu status changes no client subscribed to\n", (unsigned long long)skipped);
+}
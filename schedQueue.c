@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "schedQueue.h"
+
+//initialize a queue for at most capacity waiting items
+int sched_queue_init(SchedQueue *queue, SchedPolicy policy, size_t capacity) {
+    queue->policy = policy;
+    queue->count = 0;
+    queue->capacity = capacity;
+    queue->next_sequence = 0;
+    queue->heap = NULL;
+    if (policy == SCHEDULE_FIFO) return stage_queue_init(&queue->fifo, capacity);
+
+    queue->heap = malloc(capacity * sizeof(SchedEntry));
+    if (queue->heap == NULL) return -1;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    return 0;
+}
+
+static int entry_before(const SchedEntry *a, const SchedEntry *b) {
+    return a->key != b->key ? a->key < b->key : a->sequence < b->sequence;
+}
+
+//add an item with its priority key, smaller keys are served first, returns -1 if the queue is full
+int sched_queue_push(SchedQueue *queue, void *item, uint64_t key) {
+    if (queue->policy == SCHEDULE_FIFO) return stage_queue_push(&queue->fifo, item);
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count == queue->capacity) {
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
+    }
+    SchedEntry entry = {key, queue->next_sequence++, item};
+    size_t i = queue->count++;
+    while (i > 0 && entry_before(&entry, &queue->heap[(i - 1) / 2])) { //sift up
+        queue->heap[i] = queue->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->heap[i] = entry;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+//remove the first item of the heap, the mutex must be held and the heap must not be empty
+static void *heap_pop(SchedQueue *queue) {
+    void *item = queue->heap[0].item;
+    SchedEntry last = queue->heap[--queue->count];
+    size_t i = 0;
+    while (1) { //sift the last entry down from the root
+        size_t child = 2 * i + 1;
+        if (child >= queue->count) break;
+        if (child + 1 < queue->count && entry_before(&queue->heap[child + 1], &queue->heap[child])) child++;
+        if (!entry_before(&queue->heap[child], &last)) break;
+        queue->heap[i] = queue->heap[child];
+        i = child;
+    }
+    queue->heap[i] = last;
+    return item;
+}
+
+//take the most urgent item, NULL if the queue is empty
+void *sched_queue_pop(SchedQueue *queue) {
+    if (queue->policy == SCHEDULE_FIFO) return stage_queue_pop(&queue->fifo);
+
+    pthread_mutex_lock(&queue->mutex);
+    void *item = queue->count > 0 ? heap_pop(queue) : NULL;
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+//take the most urgent item, sleeping until one arrives
+void *sched_queue_pop_wait(SchedQueue *queue) {
+    if (queue->policy == SCHEDULE_FIFO) return stage_queue_pop_wait(&queue->fifo);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    void *item = heap_pop(queue);
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+//number of items waiting, a snapshot
+size_t sched_queue_depth(SchedQueue *queue) {
+    if (queue->policy == SCHEDULE_FIFO) return stage_queue_depth(&queue->fifo);
+
+    pthread_mutex_lock(&queue->mutex);
+    size_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+//priority key of an order received at received_ns whose preparation, cooking and delivery should take estimate_ns
+uint64_t sched_key(SchedPolicy policy, uint64_t received_ns, uint64_t estimate_ns) {
+    switch (policy) {
+        case SCHEDULE_EDF:
+            return received_ns + estimate_ns;
+        case SCHEDULE_STF:
+            return estimate_ns;
+        default:
+            return received_ns;
+    }
+}
+
+int sched_parse_policy(const char *name, SchedPolicy *policy) {
+    if (strcmp(name, "fifo") == 0) {
+        *policy = SCHEDULE_FIFO;
+    } else if (strcmp(name, "edf") == 0) {
+        *policy = SCHEDULE_EDF;
+    } else if (strcmp(name, "stf") == 0) {
+        *policy = SCHEDULE_STF;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *sched_policy_name(SchedPolicy policy) {
+    switch (policy) {
+        case SCHEDULE_EDF:
+            return "earliest deadline first";
+        case SCHEDULE_STF:
+            return "shortest total time first";
+        default:
+            return "FIFO";
+    }
+}
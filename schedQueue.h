@@ -0,0 +1,45 @@
+#ifndef SCHED_QUEUE_H
+#define SCHED_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "stageQueue.h"
+
+//order in which a stage serves the orders waiting for it
+typedef enum {
+    SCHEDULE_FIFO, //arrival order, served by the lock-free stage queue
+    SCHEDULE_EDF, //earliest deadline first, the deadline is the time the order was received plus its estimated total time
+    SCHEDULE_STF //shortest estimated total time first, ignores how long the order has waited
+} SchedPolicy;
+
+//one waiting item of a priority queue, equal keys keep their push order
+typedef struct {
+    uint64_t key;
+    uint64_t sequence;
+    void *item;
+} SchedEntry;
+
+//queue in front of a stage, FIFO keeps the lock-free ring, the other policies use a binary heap under a mutex
+typedef struct {
+    SchedPolicy policy;
+    StageQueue fifo; //FIFO policy only
+    pthread_mutex_t mutex; //protects the heap
+    pthread_cond_t not_empty;
+    SchedEntry *heap; //min-heap on key then sequence
+    size_t count;
+    size_t capacity;
+    uint64_t next_sequence;
+} SchedQueue;
+
+int sched_queue_init(SchedQueue *queue, SchedPolicy policy, size_t capacity);
+int sched_queue_push(SchedQueue *queue, void *item, uint64_t key);
+void *sched_queue_pop(SchedQueue *queue);
+void *sched_queue_pop_wait(SchedQueue *queue);
+size_t sched_queue_depth(SchedQueue *queue);
+uint64_t sched_key(SchedPolicy policy, uint64_t received_ns, uint64_t estimate_ns);
+int sched_parse_policy(const char *name, SchedPolicy *policy);
+const char *sched_policy_name(SchedPolicy policy);
+
+#endif
@@ -0,0 +1,159 @@
+#include <math.h>
+#include <sched.h>
+
+#include "shopCore.h"
+#include "orderLog.h"
+#include "kitchenKernel.h"
+#include "shopMetrics.h"
+
+Slab order_slab; //orders in progress, slots are recycled
+SchedQueue prep_queue; //queue for waiting for prepared
+StealQueues prep_deques; //one preparation queue per cook, used instead of prep_queue with work stealing
+SchedQueue cook_queue; //queue for waiting for cooked
+StageQueue delivery_queue; //queue for waiting for delivered
+static int work_stealing = 0; //orders for preparation go to prep_deques
+static SchedPolicy queue_policy; //policy the queues were created with
+static uint32_t queue_capacity; //orders a queue can hold
+
+//initialize the order slots and the queues between the stages, a queue can hold every order in progress.
+//policy orders the preparation and cook queues, the delivery queue only feeds the dispatch grid
+int shop_core_init(uint32_t order_capacity, uint32_t max_live_orders, SchedPolicy policy) {
+    queue_policy = policy;
+    queue_capacity = max_live_orders;
+    if (slab_init(&order_slab, sizeof(Order), order_capacity, max_live_orders) < 0) return -1;
+    if (sched_queue_init(&prep_queue, policy, max_live_orders) < 0 || sched_queue_init(&cook_queue, policy, max_live_orders) < 0 || stage_queue_init(&delivery_queue, max_live_orders) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+//give every cook its own preparation queue, cooks that run out of orders steal from the others.
+//enqueue_preparation must then only be called by one thread at a time
+int shop_core_steal_preparation(int cooks) {
+    if (steal_queues_init(&prep_deques, cooks, queue_policy, queue_capacity) < 0) return -1;
+    work_stealing = 1;
+    return 0;
+}
+
+//number of cooks taking new orders, with work stealing the queues of the others get no more orders
+void shop_core_active_cooks(int cooks) {
+    if (work_stealing) steal_queues_set_active(&prep_deques, cooks);
+}
+
+//log the status of an order, the event is buffered and written by the log writer thread
+void log_order_status(Order *order, int status, int thread_id) {
+    order_log_event(order->order_id, order->x, order->y, status, thread_id, order->order_time);
+    metrics_record_transition(status, &order->status_ns);
+}
+
+//calculate the delivery time 
+int calculate_delivery_time(int x, int y, int speed) {
+    return calculate_leg_time(0, 0, x, y, speed);
+}
+
+//calculate the travel time between two addresses
+int calculate_leg_time(int from_x, int from_y, int to_x, int to_y, int speed) {
+    double dx = to_x - from_x, dy = to_y - from_y;
+    double distance = sqrt(dx * dx + dy * dy);
+    return (int)(distance / speed * 60); // Convert distance to time based on speed
+}
+
+//resolve the handle carried by a queue, NULL for an empty queue or a stale handle
+Order *order_from_queue_item(void *item) {
+    if (item == NULL) return NULL;
+    return slab_get(&order_slab, (SlabHandle)(uintptr_t)item);
+}
+
+//push the handle of an order. The queues hold every order in progress, so a failed push only means a consumer
+//was preempted between claiming a cell and releasing it while the others went once around the ring
+static void push_order(StageQueue *queue, Order *order) {
+    while (stage_queue_push(queue, (void *)(uintptr_t)order->handle) < 0) sched_yield();
+}
+
+//push the handle of an order into a stage with a scheduling policy, ordered by the key of the order
+static void schedule_order(SchedQueue *queue, Order *order) {
+    while (sched_queue_push(queue, (void *)(uintptr_t)order->handle, order->sched_key) < 0) sched_yield();
+}
+
+//enqueue an order for preparation
+void enqueue_preparation(Order *order) {
+    if (work_stealing) {
+        while (steal_queues_push(&prep_deques, (void *)(uintptr_t)order->handle, order->sched_key) < 0) sched_yield();
+        return;
+    }
+    schedule_order(&prep_queue, order);
+}
+
+//dequeue an order for preparation
+Order *dequeue_preparation() {
+    return order_from_queue_item(sched_queue_pop(&prep_queue));
+}
+
+//dequeue an order for preparation, sleeping until one arrives
+Order *dequeue_preparation_wait() {
+    Order *order;
+    while ((order = order_from_queue_item(sched_queue_pop_wait(&prep_queue))) == NULL);
+    return order;
+}
+
+//dequeue an order for preparation by a cook, from its own queue or stolen from another cook with work stealing
+Order *dequeue_preparation_by(int cook_id) {
+    if (!work_stealing) return dequeue_preparation_wait();
+    Order *order;
+    while ((order = order_from_queue_item(steal_queues_pop_wait(&prep_deques, cook_id))) == NULL);
+    return order;
+}
+
+//take an order left in the own queue of a retiring cook without waiting or stealing, NULL when it is empty
+Order *dequeue_preparation_leftover(int cook_id) {
+    if (!work_stealing) return NULL;
+    void *item;
+    Order *order = NULL;
+    while (order == NULL && (item = sched_queue_pop(&prep_deques.queues[cook_id])) != NULL) order = order_from_queue_item(item);
+    return order;
+}
+
+//number of orders waiting for a cook
+size_t preparation_depth(void) {
+    return work_stealing ? steal_queues_depth(&prep_deques) : sched_queue_depth(&prep_queue);
+}
+
+//enqueue an order for cooking
+void enqueue_cooking(Order *order) {
+    schedule_order(&cook_queue, order);
+}
+
+//dequeue an order for cooking
+Order *dequeue_cooking() {
+    return order_from_queue_item(sched_queue_pop(&cook_queue));
+}
+
+//dequeue an order for cooking, sleeping until one arrives
+Order *dequeue_cooking_wait() {
+    Order *order;
+    while ((order = order_from_queue_item(sched_queue_pop_wait(&cook_queue))) == NULL);
+    return order;
+}
+
+//enqueue an order for delivery
+void enqueue_delivery(Order *order) {
+    push_order(&delivery_queue, order);
+}
+
+//dequeue an order for delivery
+Order *dequeue_delivery() {
+    Order *order = NULL;
+    void *item;
+    while (order == NULL && (item = stage_queue_pop(&delivery_queue)) != NULL) order = order_from_queue_item(item);
+    return order;
+}
+
+//simulate a delay for preparation(30 a 40)
+void simulate_computation_delay_prep() {
+    kernel_simulate(30, 40);
+}
+
+//simulate a delay for cooking half of it (15 e 40)
+void simulate_computation_delay_cook() {
+    kernel_simulate(15, 40);
+}
@@ -0,0 +1,74 @@
+#ifndef SHOP_CORE_H
+#define SHOP_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "stageQueue.h"
+#include "schedQueue.h"
+#include "stealQueue.h"
+#include "orderSlab.h"
+#include "orderTrace.h"
+
+//order slots, stage queues and the per-order work of the shop, linked by PideShop and the benchmarks
+
+#define ORDER_HOT_BYTES (CACHE_LINE_SIZE - sizeof(SlabSlot)) //order fields sharing the cache line of the slab header
+
+//structure for hold order info. The slab starts every slot on a cache line, so the fields every stage reads or
+//writes share one line with the slot header. The second line holds the scheduling key and the timestamps: the
+//cook reads received_ns, the oven writes ready_ns, every log record reads order_time and, while metrics are
+//exported, every status change writes status_ns. A handoff between stages moves these two lines, the trace
+//span after them is only written while tracing
+typedef struct {
+    SlabHandle handle; //generation tagged handle, what the stage queues carry
+    struct Connection *connection; //framed connection the order came in on, NULL for a legacy order
+    int status; //status of the order (0: ordered, 1: preparing, 2: cooking, 3: ready for delivery, 4: out for delivery, 5: delivered, 6: canceled)
+    atomic_int hung_up; //set by the ingress loop when the client disconnects, stages skip the order
+    uint32_t notify_mask; //STATUS_BIT of every status the client subscribed to
+    int client_socket; //socket to communicate with the client
+    int order_id;
+    int x, y; //coordinates of the delivery address, logged with every status
+    int canceled_flag; // flag to indicate if the order was canceled
+
+    uint64_t sched_key; //priority in the preparation and cook queues, smaller is served first
+    uint64_t received_ns; //monotonic time the manager accepted the order
+    uint64_t ready_ns; //monotonic time the order became ready for delivery
+    time_t order_time; //time the order was placed
+    uint64_t status_ns; //monotonic time of the last status change, only kept while metrics are exported
+    OrderSpan span; //monotonic time of every stage boundary, only kept while tracing
+} Order;
+
+_Static_assert(offsetof(Order, sched_key) == ORDER_HOT_BYTES, "hot order fields must fill the cache line of the slot header");
+_Static_assert(offsetof(Order, span) <= ORDER_HOT_BYTES + CACHE_LINE_SIZE, "order timestamps must fit the second cache line of the slot");
+
+
+extern Slab order_slab; //orders in progress, slots are recycled
+extern SchedQueue prep_queue; //queue for waiting for prepared
+extern StealQueues prep_deques; //one preparation queue per cook, used instead of prep_queue with work stealing
+extern SchedQueue cook_queue; //queue for waiting for cooked
+extern StageQueue delivery_queue; //queue for waiting for delivered
+
+int shop_core_init(uint32_t order_capacity, uint32_t max_live_orders, SchedPolicy policy);
+int shop_core_steal_preparation(int cooks);
+void shop_core_active_cooks(int cooks);
+void log_order_status(Order *order, int status, int thread_id);
+int calculate_delivery_time(int x, int y, int speed);
+int calculate_leg_time(int from_x, int from_y, int to_x, int to_y, int speed);
+Order *order_from_queue_item(void *item);
+void enqueue_preparation(Order *order);
+Order *dequeue_preparation();
+Order *dequeue_preparation_wait();
+Order *dequeue_preparation_by(int cook_id);
+Order *dequeue_preparation_leftover(int cook_id);
+size_t preparation_depth(void);
+void enqueue_cooking(Order *order);
+Order *dequeue_cooking();
+Order *dequeue_cooking_wait();
+void enqueue_delivery(Order *order);
+Order *dequeue_delivery();
+void simulate_computation_delay_prep();
+void simulate_computation_delay_cook();
+
+#endif
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "shopMetrics.h"
+#include "latencyHistogram.h"
+#include "orderLog.h"
+#include "stageQueue.h"
+
+#define MAX_METRICS_SHARDS 4096 //maximum number of threads that may record transitions at once
+#define MAX_METRICS_GAUGES 32
+#define METRICS_REQUEST_SIZE 4096 //bytes of the scrape request that are read and ignored
+
+//transition histograms of one thread, merged with the other shards when scraped
+typedef struct {
+    LatencyHistogram transitions[METRICS_TRANSITIONS];
+    atomic_int in_use; //cleared when the owning thread exits so the shard can be reused
+} MetricsShard;
+
+//value read on every scrape, name{labels}
+typedef struct {
+    const char *name;
+    const char *labels;
+    const char *help;
+    MetricsGaugeRead read;
+} MetricsGauge;
+
+static const char *transition_names[METRICS_TRANSITIONS] = {
+    "received_preparing", "preparing_cooking", "cooking_ready", "ready_out", "out_delivered"
+};
+//upper bounds of the exported histogram buckets in seconds
+static const double bucket_bounds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+};
+
+static atomic_int enabled = 0; //transitions are only timed once the stats socket is open
+static _Atomic(MetricsShard *) shards[MAX_METRICS_SHARDS]; //shards of all threads that ever recorded
+static atomic_int shard_count = 0;
+static pthread_mutex_t register_mutex = PTHREAD_MUTEX_INITIALIZER; //taken once per thread and once per worker
+static pthread_key_t shard_key;
+static _Thread_local MetricsShard *thread_shard;
+static _Atomic(MetricsWorker *) workers; //newest worker first
+static MetricsGauge gauges[MAX_METRICS_GAUGES];
+static atomic_int gauge_count = 0;
+static int metrics_socket;
+static pthread_t scrape_thread;
+
+static void *scrape_routine(void *arg);
+
+//called when a recording thread exits, its counts stay in the shard for the next owner
+static void release_shard(void *shard) {
+    atomic_store(&((MetricsShard *)shard)->in_use, 0);
+}
+
+//give the calling thread a shard, reusing one left behind by an exited thread
+static MetricsShard *register_thread(void) {
+    MetricsShard *shard = NULL;
+    pthread_mutex_lock(&register_mutex);
+    int count = atomic_load(&shard_count);
+    for (int i = 0; i < count && shard == NULL; i++) {
+        MetricsShard *candidate = atomic_load(&shards[i]);
+        if (!atomic_load(&candidate->in_use)) shard = candidate;
+    }
+    if (shard == NULL && count < MAX_METRICS_SHARDS) {
+        shard = aligned_alloc(CACHE_LINE_SIZE, sizeof(MetricsShard));
+        if (shard != NULL) {
+            for (int i = 0; i < METRICS_TRANSITIONS; i++) histogram_init(&shard->transitions[i]);
+            atomic_store(&shards[count], shard);
+            atomic_store(&shard_count, count + 1);
+        }
+    }
+    if (shard != NULL) atomic_store(&shard->in_use, 1);
+    pthread_mutex_unlock(&register_mutex);
+
+    if (shard != NULL) pthread_setspecific(shard_key, shard);
+    return shard;
+}
+
+//listen on 127.0.0.1:port and start answering scrapes, transitions are recorded from now on
+int metrics_open(int port) {
+    struct sockaddr_in addr;
+    int opt = 1;
+
+    metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (metrics_socket < 0) return -1;
+    setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(metrics_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(metrics_socket, 16) < 0) {
+        close(metrics_socket);
+        return -1;
+    }
+
+    pthread_key_create(&shard_key, release_shard);
+    atomic_store(&enabled, 1);
+    if (pthread_create(&scrape_thread, NULL, scrape_routine, NULL) != 0) {
+        atomic_store(&enabled, 0);
+        close(metrics_socket);
+        return -1;
+    }
+    pthread_detach(scrape_thread);
+    return 0;
+}
+
+//called on every status change, times the transition into status and restarts the clock of the order
+void metrics_record_transition(int status, uint64_t *status_ns) {
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+    uint64_t now = monotonic_ns();
+    if (status >= 1 && status <= METRICS_TRANSITIONS && *status_ns != 0) {
+        if (thread_shard == NULL) thread_shard = register_thread();
+        if (thread_shard != NULL) histogram_record(&thread_shard->transitions[status - 1], now - *status_ns);
+    }
+    *status_ns = now;
+}
+
+//register a cook, oven or courier, the returned worker lives as long as the process
+MetricsWorker *metrics_worker(const char *role, int id) {
+    MetricsWorker *worker = aligned_alloc(CACHE_LINE_SIZE, sizeof(MetricsWorker));
+    if (worker == NULL) return NULL;
+    worker->role = role;
+    worker->id = id;
+    worker->started_ns = monotonic_ns();
+    atomic_init(&worker->busy_ns, 0);
+    pthread_mutex_lock(&register_mutex);
+    worker->next = atomic_load(&workers);
+    atomic_store(&workers, worker);
+    pthread_mutex_unlock(&register_mutex);
+    return worker;
+}
+
+//single writer add of time the worker spent on orders, nothing is written until the stats socket is open
+void metrics_add_busy(MetricsWorker *worker, uint64_t ns) {
+    if (worker == NULL || !atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+    add_relaxed(&worker->busy_ns, ns);
+}
+
+//export read() as name{labels}, gauges of the same name must be registered one after another
+int metrics_gauge(const char *name, const char *labels, const char *help, MetricsGaugeRead read) {
+    int count = atomic_load(&gauge_count);
+    if (count >= MAX_METRICS_GAUGES) return -1;
+    gauges[count] = (MetricsGauge){name, labels, help, read};
+    atomic_store(&gauge_count, count + 1);
+    return 0;
+}
+
+static void write_transitions(FILE *out) {
+    LatencyHistogram *merged = malloc(sizeof(LatencyHistogram));
+    if (merged == NULL) return;
+
+    fprintf(out, "# HELP pide_transition_seconds Time an order spent between two statuses\n");
+    fprintf(out, "# TYPE pide_transition_seconds histogram\n");
+    int count = atomic_load(&shard_count);
+    for (int t = 0; t < METRICS_TRANSITIONS; t++) {
+        histogram_init(merged);
+        for (int i = 0; i < count; i++) histogram_merge(merged, &atomic_load(&shards[i])->transitions[t]);
+        for (size_t b = 0; b < sizeof(bucket_bounds) / sizeof(bucket_bounds[0]); b++) {
+            fprintf(out, "pide_transition_seconds_bucket{transition=\"%s\",le=\"%g\"} %llu\n", transition_names[t], bucket_bounds[b],
+                    (unsigned long long)histogram_count_at_most(merged, (uint64_t)(bucket_bounds[b] * 1e9)));
+        }
+        unsigned long long total = atomic_load(&merged->count);
+        fprintf(out, "pide_transition_seconds_bucket{transition=\"%s\",le=\"+Inf\"} %llu\n", transition_names[t], total);
+        fprintf(out, "pide_transition_seconds_sum{transition=\"%s\"} %.9f\n", transition_names[t], atomic_load(&merged->sum) / 1e9);
+        fprintf(out, "pide_transition_seconds_count{transition=\"%s\"} %llu\n", transition_names[t], total);
+    }
+    free(merged);
+}
+
+static void write_gauges(FILE *out) {
+    int count = atomic_load(&gauge_count);
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || strcmp(gauges[i].name, gauges[i - 1].name) != 0) {
+            fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n", gauges[i].name, gauges[i].help, gauges[i].name);
+        }
+        if (gauges[i].labels != NULL) {
+            fprintf(out, "%s{%s} %g\n", gauges[i].name, gauges[i].labels, gauges[i].read());
+        } else {
+            fprintf(out, "%s %g\n", gauges[i].name, gauges[i].read());
+        }
+    }
+}
+
+static void write_workers(FILE *out) {
+    uint64_t now = monotonic_ns();
+
+    fprintf(out, "# HELP pide_worker_busy_seconds_total Time a worker spent on orders\n");
+    fprintf(out, "# TYPE pide_worker_busy_seconds_total counter\n");
+    for (MetricsWorker *worker = atomic_load(&workers); worker != NULL; worker = worker->next) {
+        fprintf(out, "pide_worker_busy_seconds_total{role=\"%s\",id=\"%d\"} %.9f\n", worker->role, worker->id,
+                atomic_load_explicit(&worker->busy_ns, memory_order_relaxed) / 1e9);
+    }
+    fprintf(out, "# HELP pide_worker_utilization Share of its lifetime a worker spent on orders\n");
+    fprintf(out, "# TYPE pide_worker_utilization gauge\n");
+    for (MetricsWorker *worker = atomic_load(&workers); worker != NULL; worker = worker->next) {
+        uint64_t lifetime = now > worker->started_ns ? now - worker->started_ns : 1;
+        fprintf(out, "pide_worker_utilization{role=\"%s\",id=\"%d\"} %.4f\n", worker->role, worker->id,
+                (double)atomic_load_explicit(&worker->busy_ns, memory_order_relaxed) / lifetime);
+    }
+}
+
+//answer one scrape with the Prometheus text format, whatever path was asked for
+static void answer_scrape(int client) {
+    char request[METRICS_REQUEST_SIZE];
+    struct timeval timeout = {1, 0};
+    char *body = NULL;
+    size_t body_size = 0;
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (read(client, request, sizeof(request)) < 0) return;
+
+    FILE *out = open_memstream(&body, &body_size);
+    if (out == NULL) return;
+    write_transitions(out);
+    write_gauges(out);
+    write_workers(out);
+    fclose(out);
+
+    char header[128];
+    int header_size = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body_size);
+    if (write(client, header, header_size) == header_size) {
+        for (size_t sent = 0; sent < body_size;) {
+            ssize_t n = write(client, body + sent, body_size - sent);
+            if (n <= 0) break;
+            sent += n;
+        }
+    }
+    free(body);
+}
+
+static void *scrape_routine(void *arg) {
+    (void)arg;
+    while (1) {
+        int client = accept(metrics_socket, NULL, NULL);
+        if (client < 0) continue;
+        answer_scrape(client);
+        close(client);
+    }
+    return NULL;
+}
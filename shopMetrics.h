@@ -0,0 +1,29 @@
+#ifndef SHOP_METRICS_H
+#define SHOP_METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "stageQueue.h"
+
+#define METRICS_TRANSITIONS 5 //received->preparing, preparing->cooking, cooking->ready, ready->out, out->delivered
+
+//busy time of one cook, oven or courier, only the worker itself adds to it. Every worker owns a cache line
+//so the add after each order does not invalidate the counter of the worker registered next to it
+typedef struct MetricsWorker {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t busy_ns; //time spent working on orders
+    const char *role;
+    int id;
+    uint64_t started_ns; //monotonic time the worker was registered
+    struct MetricsWorker *next;
+} MetricsWorker;
+
+typedef double (*MetricsGaugeRead)(void);
+
+int metrics_open(int port);
+void metrics_record_transition(int status, uint64_t *status_ns);
+MetricsWorker *metrics_worker(const char *role, int id);
+void metrics_add_busy(MetricsWorker *worker, uint64_t ns);
+int metrics_gauge(const char *name, const char *labels, const char *help, MetricsGaugeRead read);
+
+#endif
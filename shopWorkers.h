@@ -0,0 +1,58 @@
+#ifndef SHOP_WORKERS_H
+#define SHOP_WORKERS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "stageQueue.h"
+#include "shopCore.h"
+#include "shopMetrics.h"
+#include "latencyHistogram.h"
+#include "timerWheel.h"
+
+#define MAX_DELIVERY_BAG 3
+
+//structure for cook, every cook owns whole cache lines so counting its orders does not invalidate its neighbors'
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_t thread; //thread ID
+    int id; //cook ID
+    Order *order; //order being prepared by the cook
+    int prepared_orders; //number of orders prepared by the cook
+    MetricsWorker *metrics; //time spent preparing, for the utilization
+} Cook;
+
+//structure for oven worker, each one holds an oven slot while cooking and owns whole cache lines like a cook
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_t thread; //thread ID
+    int id; //oven worker ID
+    int cooked_orders; //number of orders cooked by the oven worker
+    MetricsWorker *metrics; //time spent cooking, for the utilization
+} OvenWorker;
+
+//structure fordelivery person, padded to whole cache lines like a cook
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_t thread; //thread ID
+    int id; //delivery person ID
+    int speed; //speed of the delivery person
+    Order *bag[MAX_DELIVERY_BAG]; //bag to hold orders for delivery
+    int bag_count; //number of orders in the bag
+    int delivered_orders; //number of orders delivered by the delivery person
+    LatencyHistogram *pickup_latency; //time orders waited between ready and out for delivery
+    int route[MAX_DELIVERY_BAG]; //bag indices in the order of the planned route
+    int next_stop; //position in route of the next address, wheel engine only
+    int x, y; //current position, wheel engine only
+    TimerEntry timer; //fires when the courier reaches the next address, wheel engine only
+    uint64_t route_start_ns; //time the courier left the shop, wheel engine only
+    MetricsWorker *metrics; //time spent on the road, for the utilization
+} DeliveryPerson;
+
+//structure for a thread of the wheel delivery engine, drives many couriers with one timer wheel
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_t thread; //thread ID
+    int id; //engine ID
+    TimerWheel wheel; //arrival timers of the couriers on the road
+    DeliveryPerson **idle; //couriers waiting at the shop for a bag
+    int idle_count; //number of idle couriers
+} CourierEngine;
+
+#endif
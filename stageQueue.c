@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <limits.h>
+
+#include "stageQueue.h"
+
+//initialize a queue that holds at least capacity items
+int stage_queue_init(StageQueue *queue, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    queue->cells = malloc(size * sizeof(StageQueueCell));
+    if (queue->cells == NULL) return -1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].item = NULL;
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->event, 0);
+    atomic_init(&queue->waiters, 0);
+    return 0;
+}
+
+//release the ring of a queue
+void stage_queue_destroy(StageQueue *queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+//add an item to the queue, returns -1 if the queue is full
+int stage_queue_push(StageQueue *queue, void *item) {
+    StageQueueCell *cell;
+    size_t position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    while (1) {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return -1; //the consumers have not freed this cell yet
+        } else {
+            position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->item = item;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+
+    //only pay for the wake syscall when a consumer is actually asleep
+    atomic_fetch_add(&queue->event, 1);
+    if (atomic_load(&queue->waiters) > 0) futex_wake(&queue->event, 1);
+    return 0;
+}
+
+//remove an item from the queue, returns NULL if the queue is empty
+void *stage_queue_pop(StageQueue *queue) {
+    StageQueueCell *cell;
+    size_t position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    while (1) {
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return NULL; //no producer has filled this cell yet
+        } else {
+            position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    void *item = cell->item;
+    atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+    return item;
+}
+
+//remove an item from the queue, sleeping on the futex while it is empty
+void *stage_queue_pop_wait(StageQueue *queue) {
+    while (1) {
+        void *item = stage_queue_pop(queue);
+        if (item != NULL) return item;
+
+        //announce the waiter before the final check so a concurrent push cannot be missed
+        uint32_t event = atomic_load(&queue->event);
+        atomic_fetch_add(&queue->waiters, 1);
+        item = stage_queue_pop(queue);
+        if (item == NULL) futex_wait(&queue->event, event);
+        atomic_fetch_sub(&queue->waiters, 1);
+        if (item != NULL) return item;
+    }
+}
+
+//snapshot of the queue events, take it before looking for work elsewhere and pass it to stage_queue_pop_timed
+uint32_t stage_queue_watch(StageQueue *queue) {
+    return atomic_load(&queue->event);
+}
+
+//remove an item from the queue, sleeping at most timeout_ns unless something was pushed or notified
+//after the watched snapshot; returns NULL on timeout or notify
+void *stage_queue_pop_timed(StageQueue *queue, uint32_t watched, uint64_t timeout_ns) {
+    void *item = stage_queue_pop(queue);
+    if (item != NULL || timeout_ns == 0) return item;
+
+    atomic_fetch_add(&queue->waiters, 1);
+    if (timeout_ns == STAGE_QUEUE_FOREVER) {
+        futex_wait(&queue->event, watched);
+    } else {
+        futex_wait_timed(&queue->event, watched, timeout_ns);
+    }
+    atomic_fetch_sub(&queue->waiters, 1);
+    return stage_queue_pop(queue);
+}
+
+//wake one sleeping consumer without adding an item, used when work is waiting outside the queue
+void stage_queue_notify(StageQueue *queue) {
+    atomic_fetch_add(&queue->event, 1);
+    if (atomic_load(&queue->waiters) > 0) futex_wake(&queue->event, 1);
+}
+
+//approximate number of items waiting in the queue
+size_t stage_queue_depth(StageQueue *queue) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
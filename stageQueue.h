@@ -0,0 +1,64 @@
+#ifndef STAGE_QUEUE_H
+#define STAGE_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define CACHE_LINE_SIZE 64
+#define STAGE_QUEUE_FOREVER UINT64_MAX //timeout of a wait that only ends with an item or a notify
+
+//sleep while the futex word still holds the expected value
+static inline void futex_wait(_Atomic uint32_t *word, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+//sleep while the futex word still holds the expected value, at most timeout_ns
+static inline void futex_wait_timed(_Atomic uint32_t *word, uint32_t expected, uint64_t timeout_ns) {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ns / 1000000000ull;
+    timeout.tv_nsec = timeout_ns % 1000000000ull;
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, expected, &timeout, NULL, 0);
+}
+
+//wake up to count threads sleeping on the futex word
+static inline void futex_wake(_Atomic uint32_t *word, int count) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+//single writer increment, readers may see it a little late but never torn
+static inline void add_relaxed(_Atomic uint64_t *counter, uint64_t value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+//one slot of the ring, sequence tells producers and consumers whose turn it is
+typedef struct {
+    atomic_size_t sequence;
+    void *item;
+} StageQueueCell;
+
+//bounded lock-free multi-producer multi-consumer queue between two pipeline stages
+typedef struct {
+    StageQueueCell *cells; //ring of capacity cells
+    size_t mask; //capacity - 1, capacity is a power of two
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail; //next position to enqueue
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head; //next position to dequeue
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t event; //futex word bumped on every enqueue
+    _Atomic uint32_t waiters; //number of consumers sleeping on event
+} StageQueue;
+
+int stage_queue_init(StageQueue *queue, size_t capacity);
+void stage_queue_destroy(StageQueue *queue);
+int stage_queue_push(StageQueue *queue, void *item);
+void *stage_queue_pop(StageQueue *queue);
+void *stage_queue_pop_wait(StageQueue *queue);
+uint32_t stage_queue_watch(StageQueue *queue);
+void *stage_queue_pop_timed(StageQueue *queue, uint32_t watched, uint64_t timeout_ns);
+void stage_queue_notify(StageQueue *queue);
+size_t stage_queue_depth(StageQueue *queue);
+
+#endif
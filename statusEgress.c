@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "statusEgress.h"
+#include "stageQueue.h"
+#include "orderLog.h"
+#include "pideProtocol.h"
+
+#define EGRESS_INITIAL_BUFFER 64 //first output buffer of a socket, doubled as needed
+#define EGRESS_MAX_BUFFER (1 << 20) //bytes a socket may have pending, a client that falls further behind is dropped
+#define EGRESS_BATCH 1024 //messages taken from the queue per round
+#define EGRESS_CHUNK 256 //socket states allocated together
+#define EGRESS_POLL_NS 1000000ull //how often the sender looks at slow sockets while it has no new messages
+#define EGRESS_SHUTDOWN_NS 100000000ull //longest the sender keeps writing after it was told to stop
+//a message is one word: status in bits 0-3, flags in bits 4-7, socket in bits 8-31, order id or version in bits 32-63
+#define EGRESS_CLOSE (1u << 4) //close the socket once its statuses are written
+#define EGRESS_FRAMED (1u << 5) //write a StatusFrame instead of a bare int
+#define EGRESS_HELLO (1u << 6) //write a ProtocolHello
+#define EGRESS_VALID (1u << 7) //set in every message so none is mistaken for an empty queue
+#define EGRESS_SOCKET_SHIFT 8
+#define EGRESS_MAX_SOCKET ((1 << 24) - 1)
+#define EGRESS_STOP ((void *)(uintptr_t)(EGRESS_VALID | EGRESS_CLOSE | EGRESS_HELLO)) //message that stops the sender
+#define EGRESS_NO_SOCKET -1
+#define URING_OP_CLOSE (1ull << 32) //user_data flag of a close operation
+#define URING_OP_POLL (1ull << 33) //user_data flag of a poll for room in a full socket
+
+//pending output of one client socket, only touched by the sender thread
+typedef struct {
+    unsigned char *buffer; //statuses not written yet
+    unsigned char *retired; //smaller buffer an io_uring send still reads from, freed on its completion
+    uint32_t capacity; //size of buffer
+    uint32_t length; //bytes in buffer
+    uint32_t sent; //bytes of buffer already written
+    int next_dirty; //next socket of the dirty list
+    uint8_t dirty; //in the dirty list
+    uint8_t in_flight; //an io_uring operation or an EPOLLOUT wait is outstanding
+    uint8_t close_after; //close once the buffer is written
+    uint8_t watched; //registered in the epoll instance
+    uint8_t failed; //the client is gone or too far behind, its output is discarded until the owner closes it
+} EgressSocket;
+
+//mapped rings of the io_uring instance
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries, cq_entries;
+    unsigned to_submit; //entries written since the last io_uring_enter
+} Uring;
+
+static EgressMode egress_mode;
+static StageQueue queue; //packed messages from the workers
+static pthread_t sender_thread;
+static EgressSocket **socket_chunks; //socket states by descriptor, chunks are allocated on first use
+static size_t chunk_count;
+static int dirty_head = EGRESS_NO_SOCKET, dirty_tail = EGRESS_NO_SOCKET; //sockets with output to start
+static unsigned in_flight_count; //sockets waiting for a completion or for EPOLLOUT
+static Uring uring;
+static int epoll_fd = -1;
+static atomic_uint_fast64_t status_count, syscall_count;
+
+static void *sender_routine(void *arg);
+
+static int uring_setup(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring.fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (uring.fd < 0) return -1;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) sq_size = cq_size;
+        cq_size = sq_size;
+    }
+    unsigned char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) goto fail;
+    unsigned char *cq = sq;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) goto fail;
+    }
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    if (uring.sqes == MAP_FAILED) goto fail;
+
+    uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    uring.sq_entries = params.sq_entries;
+    uring.cq_entries = params.cq_entries;
+    uring.to_submit = 0;
+    return 0;
+
+fail:
+    close(uring.fd);
+    return -1;
+}
+
+//next free submission entry, NULL if the ring is full
+static struct io_uring_sqe *uring_get_sqe(void) {
+    unsigned tail = *uring.sq_tail;
+    if (tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) >= uring.sq_entries) return NULL;
+    unsigned index = tail & *uring.sq_mask;
+    struct io_uring_sqe *sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring.sq_array[index] = index;
+    __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring.to_submit++;
+    return sqe;
+}
+
+//hand every written entry to the kernel with one system call
+static void uring_submit(void) {
+    while (uring.to_submit > 0) {
+        int submitted = syscall(__NR_io_uring_enter, uring.fd, uring.to_submit, 0, 0, NULL, 0);
+        atomic_fetch_add(&syscall_count, 1);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            perror("io_uring_enter");
+            return;
+        }
+        uring.to_submit -= submitted;
+    }
+}
+
+//state of a descriptor, allocating its chunk on first use
+static EgressSocket *egress_socket(int socket) {
+    size_t chunk = socket / EGRESS_CHUNK;
+    if (chunk >= chunk_count) return NULL;
+    if (socket_chunks[chunk] == NULL) {
+        socket_chunks[chunk] = calloc(EGRESS_CHUNK, sizeof(EgressSocket));
+        if (socket_chunks[chunk] == NULL) return NULL;
+    }
+    return &socket_chunks[chunk][socket % EGRESS_CHUNK];
+}
+
+//forget a closed socket, its descriptor may be reused from here on
+static void reset_socket(EgressSocket *state) {
+    free(state->buffer);
+    free(state->retired);
+    memset(state, 0, sizeof(*state));
+}
+
+//append bytes to the output of a socket, growing its buffer. Returns -1 if the client is too far behind
+static int append_output(EgressSocket *state, const void *data, size_t size) {
+    if (state->length + size > state->capacity && !state->in_flight && state->sent > 0) {
+        memmove(state->buffer, state->buffer + state->sent, state->length - state->sent); //reuse the written part
+        state->length -= state->sent;
+        state->sent = 0;
+    }
+    if (state->length + size > state->capacity) {
+        size_t capacity = state->capacity > 0 ? state->capacity : EGRESS_INITIAL_BUFFER;
+        while (capacity < state->length + size) capacity *= 2;
+        if (capacity > EGRESS_MAX_BUFFER) return -1;
+        unsigned char *buffer = malloc(capacity);
+        if (buffer == NULL) return -1;
+        memcpy(buffer, state->buffer, state->length);
+        if (state->in_flight && egress_mode == EGRESS_URING && state->retired == NULL) {
+            state->retired = state->buffer; //the kernel may still be reading it
+        } else {
+            free(state->buffer);
+        }
+        state->buffer = buffer;
+        state->capacity = capacity;
+    }
+    memcpy(state->buffer + state->length, data, size);
+    state->length += size;
+    return 0;
+}
+
+//give up on a client that failed or stopped reading. The descriptor stays open until its owner queues the close,
+//so it can not be reused while workers still write to it, and the shutdown shows the ingress loop a hang-up
+static void drop_client(int socket, EgressSocket *state) {
+    state->failed = 1;
+    state->length = state->sent = 0;
+    shutdown(socket, SHUT_RDWR);
+    atomic_fetch_add(&syscall_count, 1);
+}
+
+//queue a socket for the next flush
+static void mark_dirty(int socket, EgressSocket *state) {
+    if (state->dirty) return;
+    state->dirty = 1;
+    state->next_dirty = EGRESS_NO_SOCKET;
+    if (dirty_tail == EGRESS_NO_SOCKET) {
+        dirty_head = socket;
+    } else {
+        egress_socket(dirty_tail)->next_dirty = socket;
+    }
+    dirty_tail = socket;
+}
+
+//close a socket whose output is done, through the ring when there is one
+static void close_socket(int socket, EgressSocket *state) {
+    if (egress_mode == EGRESS_URING) {
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = socket;
+            sqe->user_data = URING_OP_CLOSE | (uint32_t)socket;
+            state->in_flight = 1;
+            in_flight_count++;
+            return;
+        }
+    }
+    close(socket); //also drops it from the epoll instance
+    atomic_fetch_add(&syscall_count, 1);
+    reset_socket(state);
+}
+
+//start writing the pending statuses of a socket, or close it once they are all written
+static void start_write(int socket, EgressSocket *state) {
+    while (state->sent < state->length) {
+        if (egress_mode == EGRESS_URING) {
+            struct io_uring_sqe *sqe = in_flight_count < uring.cq_entries ? uring_get_sqe() : NULL;
+            if (sqe == NULL) {
+                mark_dirty(socket, state); //ring is full, try again next round
+                return;
+            }
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = socket;
+            sqe->addr = (uint64_t)(uintptr_t)(state->buffer + state->sent);
+            sqe->len = state->length - state->sent;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = (uint32_t)socket;
+            state->in_flight = 1;
+            in_flight_count++;
+            return;
+        }
+
+        ssize_t n = send(socket, state->buffer + state->sent, state->length - state->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        atomic_fetch_add(&syscall_count, 1);
+        if (n > 0) {
+            state->sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            //the client is slow, wait until its socket has room again
+            struct epoll_event event;
+            event.events = EPOLLOUT | EPOLLONESHOT;
+            event.data.fd = socket;
+            epoll_ctl(epoll_fd, state->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, socket, &event);
+            atomic_fetch_add(&syscall_count, 1);
+            state->watched = 1;
+            state->in_flight = 1;
+            in_flight_count++;
+            return;
+        } else {
+            drop_client(socket, state);
+        }
+    }
+
+    state->length = state->sent = 0;
+    if (state->close_after) close_socket(socket, state);
+}
+
+//add a message from a worker to the output of its socket
+static void take_message(uintptr_t message) {
+    int socket = (message >> EGRESS_SOCKET_SHIFT) & EGRESS_MAX_SOCKET;
+    uint32_t value = (uint32_t)((uint64_t)message >> 32);
+    int status = message & 0xf;
+    EgressSocket *state = egress_socket(socket);
+    if (state == NULL) return;
+
+    int result = 0;
+    if (message & EGRESS_CLOSE) {
+        state->close_after = 1;
+    } else if (state->failed) {
+        return;
+    } else if (message & EGRESS_HELLO) {
+        ProtocolHello hello = {PROTOCOL_MAGIC, value};
+        result = append_output(state, &hello, sizeof(hello));
+    } else if (message & EGRESS_FRAMED) {
+        StatusFrame frame = {{sizeof(frame) - sizeof(FrameHeader), FRAME_STATUS}, value, status};
+        result = append_output(state, &frame, sizeof(frame));
+        atomic_fetch_add(&status_count, 1);
+    } else {
+        result = append_output(state, &status, sizeof(int));
+        atomic_fetch_add(&status_count, 1);
+    }
+    if (result < 0) drop_client(socket, state); //a client this far behind is not reading at all
+    if (!state->in_flight) mark_dirty(socket, state);
+}
+
+//start output on every dirty socket that has no operation outstanding
+static void flush_dirty(void) {
+    int socket = dirty_head;
+    dirty_head = dirty_tail = EGRESS_NO_SOCKET;
+    while (socket != EGRESS_NO_SOCKET) {
+        EgressSocket *state = egress_socket(socket);
+        int next = state->next_dirty;
+        state->dirty = 0;
+        if (!state->in_flight) start_write(socket, state);
+        socket = next;
+    }
+    if (egress_mode == EGRESS_URING) uring_submit();
+}
+
+//handle finished io_uring operations
+static void reap_uring(void) {
+    unsigned head = *uring.cq_head;
+    while (head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+        int socket = (int)(uint32_t)cqe->user_data;
+        EgressSocket *state = egress_socket(socket);
+        in_flight_count--;
+        if (cqe->user_data & URING_OP_CLOSE) {
+            reset_socket(state);
+        } else {
+            state->in_flight = 0;
+            free(state->retired);
+            state->retired = NULL;
+            if (cqe->user_data & URING_OP_POLL) {
+                //the socket has room again, or failed and the next send finds out
+            } else if (cqe->res > 0) {
+                state->sent += cqe->res;
+            } else if (cqe->res == -EAGAIN) {
+                //a non-blocking socket is full, wait in the ring until it has room
+                struct io_uring_sqe *sqe = uring_get_sqe();
+                if (sqe != NULL) {
+                    sqe->opcode = IORING_OP_POLL_ADD;
+                    sqe->fd = socket;
+                    sqe->poll32_events = POLLOUT;
+                    sqe->user_data = URING_OP_POLL | (uint32_t)socket;
+                    state->in_flight = 1;
+                    in_flight_count++;
+                    head++;
+                    continue;
+                }
+            } else if (cqe->res < 0 && cqe->res != -EINTR) {
+                drop_client(socket, state);
+            }
+            mark_dirty(socket, state);
+        }
+        head++;
+    }
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+    uring_submit(); //polls for full sockets
+}
+
+//handle slow sockets that have room again
+static void reap_epoll(void) {
+    struct epoll_event events[EGRESS_CHUNK];
+    int ready = epoll_wait(epoll_fd, events, EGRESS_CHUNK, 0);
+    atomic_fetch_add(&syscall_count, 1);
+    for (int i = 0; i < ready; i++) {
+        EgressSocket *state = egress_socket(events[i].data.fd);
+        state->in_flight = 0;
+        in_flight_count--;
+        mark_dirty(events[i].data.fd, state);
+    }
+}
+
+//sender thread: coalesce the statuses of each socket and write them in batches
+static void *sender_routine(void *arg) {
+    (void)arg;
+    int stopping = 0;
+    uint64_t give_up_ns = 0; //slow clients do not hold up a shutdown for longer than this
+
+    while (!stopping || ((in_flight_count > 0 || dirty_head != EGRESS_NO_SOCKET) && monotonic_ns() < give_up_ns)) {
+        uint32_t watched = stage_queue_watch(&queue);
+        void *item;
+        if (stopping) {
+            item = stage_queue_pop_timed(&queue, watched, EGRESS_POLL_NS);
+        } else if (dirty_head != EGRESS_NO_SOCKET) {
+            item = stage_queue_pop(&queue);
+        } else if (in_flight_count > 0) {
+            item = stage_queue_pop_timed(&queue, watched, EGRESS_POLL_NS);
+        } else {
+            item = stage_queue_pop_wait(&queue);
+        }
+
+        for (int taken = 1; item != NULL; taken++) {
+            if (item == EGRESS_STOP) {
+                stopping = 1;
+                give_up_ns = monotonic_ns() + EGRESS_SHUTDOWN_NS;
+            } else {
+                take_message((uintptr_t)item);
+            }
+            item = taken < EGRESS_BATCH ? stage_queue_pop(&queue) : NULL; //the rest waits for the next round
+        }
+
+        if (in_flight_count > 0) egress_mode == EGRESS_URING ? reap_uring() : reap_epoll();
+        flush_dirty();
+        if (egress_mode == EGRESS_URING) reap_uring(); //sends to healthy sockets usually complete right away
+    }
+    return NULL;
+}
+
+//start the sender thread, queue_capacity bounds the messages waiting for it
+int egress_open(EgressMode mode, size_t queue_capacity) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur > EGRESS_MAX_SOCKET + 1) limit.rlim_cur = EGRESS_MAX_SOCKET + 1;
+    chunk_count = (limit.rlim_cur + EGRESS_CHUNK - 1) / EGRESS_CHUNK;
+    socket_chunks = calloc(chunk_count, sizeof(EgressSocket *));
+    if (socket_chunks == NULL) return -1;
+    if (stage_queue_init(&queue, queue_capacity) < 0) return -1;
+
+    egress_mode = mode;
+    if (mode != EGRESS_EPOLL) {
+        if (uring_setup(EGRESS_RING_ENTRIES) == 0) {
+            egress_mode = EGRESS_URING;
+        } else if (mode == EGRESS_URING) {
+            return -1;
+        } else {
+            egress_mode = EGRESS_EPOLL;
+        }
+    }
+    if (egress_mode == EGRESS_EPOLL) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) return -1;
+    }
+    return pthread_create(&sender_thread, NULL, sender_routine, NULL) == 0 ? 0 : -1;
+}
+
+//pack and push a message, waiting for room if the sender is far behind
+static void push_message(int socket, uint32_t flags, int status, uint32_t value) {
+    uint64_t message = ((uint64_t)value << 32) | ((uint64_t)(socket & EGRESS_MAX_SOCKET) << EGRESS_SOCKET_SHIFT) | EGRESS_VALID | flags | (status & 0xf);
+    while (stage_queue_push(&queue, (void *)(uintptr_t)message) < 0) sched_yield();
+}
+
+//send a bare status to a legacy client, never blocks on the socket
+void egress_status(int socket, int status) {
+    push_message(socket, 0, status, 0);
+}
+
+//send a status frame tagged with the order id to a framed client
+void egress_frame_status(int socket, uint32_t order_id, int status) {
+    push_message(socket, EGRESS_FRAMED, status, order_id);
+}
+
+//answer the hello of a framed client with the protocol version of the shop, 0 if its version is not spoken
+void egress_hello(int socket, uint32_t version) {
+    push_message(socket, EGRESS_HELLO, 0, version);
+}
+
+//close a client socket after every status queued before is written
+void egress_close_socket(int socket) {
+    push_message(socket, EGRESS_CLOSE, 0, 0);
+}
+
+//write what is queued and stop the sender thread
+void egress_close(void) {
+    while (stage_queue_push(&queue, EGRESS_STOP) < 0) sched_yield();
+    pthread_join(sender_thread, NULL);
+}
+
+//parse the name of an egress mode, returns -1 if unknown
+int egress_parse_mode(const char *name, EgressMode *mode) {
+    if (strcmp(name, "auto") == 0) {
+        *mode = EGRESS_AUTO;
+    } else if (strcmp(name, "uring") == 0) {
+        *mode = EGRESS_URING;
+    } else if (strcmp(name, "epoll") == 0) {
+        *mode = EGRESS_EPOLL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+//name of the mode the sender runs in
+const char *egress_mode_name(void) {
+    return egress_mode == EGRESS_URING ? "io_uring" : "epoll";
+}
+
+//statuses queued by the workers and system calls the sender made for them
+void egress_stats(uint64_t *statuses, uint64_t *syscalls) {
+    *statuses = atomic_load(&status_count);
+    *syscalls = atomic_load(&syscall_count);
+}
@@ -0,0 +1,26 @@
+#ifndef STATUS_EGRESS_H
+#define STATUS_EGRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EGRESS_RING_ENTRIES 256 //submission queue entries of the io_uring sender
+
+//how the sender thread writes to client sockets
+typedef enum {
+    EGRESS_AUTO, //io_uring if the kernel allows it, otherwise epoll
+    EGRESS_URING, //batched io_uring send and close operations
+    EGRESS_EPOLL //non-blocking sendmsg, epoll for sockets that are full
+} EgressMode;
+
+int egress_open(EgressMode mode, size_t queue_capacity);
+void egress_status(int socket, int status);
+void egress_frame_status(int socket, uint32_t order_id, int status);
+void egress_hello(int socket, uint32_t version);
+void egress_close_socket(int socket);
+void egress_close(void);
+int egress_parse_mode(const char *name, EgressMode *mode);
+const char *egress_mode_name(void);
+void egress_stats(uint64_t *statuses, uint64_t *syscalls);
+
+#endif
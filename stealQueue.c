@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+
+#include "stealQueue.h"
+
+//initialize count queues, each one can hold capacity items since one consumer may fall far behind
+int steal_queues_init(StealQueues *steal, int count, SchedPolicy policy, size_t capacity) {
+    steal->queues = malloc(count * sizeof(SchedQueue));
+    steal->counters = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(StealCounters));
+    if (steal->queues == NULL || steal->counters == NULL) return -1;
+    for (int i = 0; i < count; i++) {
+        if (sched_queue_init(&steal->queues[i], policy, capacity) < 0) return -1;
+        atomic_init(&steal->counters[i].local, 0);
+        atomic_init(&steal->counters[i].stolen, 0);
+        atomic_init(&steal->counters[i].failed_steals, 0);
+        steal->counters[i].random = 2654435761u * (i + 1);
+    }
+    steal->count = count;
+    steal->next = 0;
+    atomic_init(&steal->active, count);
+    atomic_init(&steal->event, 0);
+    atomic_init(&steal->sleepers, 0);
+    return 0;
+}
+
+//add an item to the next active queue round robin and wake a sleeping consumer, which steals it if it is not its own.
+//Pushes must not run concurrently, returns -1 if that queue is full
+int steal_queues_push(StealQueues *steal, void *item, uint64_t key) {
+    int target = steal->next % atomic_load_explicit(&steal->active, memory_order_relaxed);
+    steal->next = target + 1;
+    if (sched_queue_push(&steal->queues[target], item, key) < 0) return -1;
+    atomic_fetch_add(&steal->event, 1);
+    if (atomic_load(&steal->sleepers) > 0) futex_wake(&steal->event, 1);
+    return 0;
+}
+
+static uint32_t next_random(StealCounters *counters) {
+    uint32_t x = counters->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return counters->random = x;
+}
+
+//take an item from the own queue, or else from the other queues starting at a random victim, NULL if all are empty
+void *steal_queues_pop(StealQueues *steal, int self) {
+    StealCounters *counters = &steal->counters[self];
+    void *item = sched_queue_pop(&steal->queues[self]);
+    if (item != NULL) {
+        add_relaxed(&counters->local, 1);
+        return item;
+    }
+    if (steal->count == 1) return NULL;
+
+    int start = next_random(counters) % (steal->count - 1);
+    for (int i = 0; i < steal->count - 1; i++) {
+        int victim = (self + 1 + (start + i) % (steal->count - 1)) % steal->count; //every queue but the own one
+        item = sched_queue_pop(&steal->queues[victim]);
+        if (item != NULL) {
+            add_relaxed(&counters->stolen, 1);
+            return item;
+        }
+        add_relaxed(&counters->failed_steals, 1);
+    }
+    return NULL;
+}
+
+//take an item for consumer self, sleeping until one is pushed to any queue
+void *steal_queues_pop_wait(StealQueues *steal, int self) {
+    while (1) {
+        void *item = steal_queues_pop(steal, self);
+        if (item != NULL) return item;
+
+        uint32_t watched = atomic_load(&steal->event);
+        item = steal_queues_pop(steal, self); //a push before the watch is seen here, one after it changes event
+        if (item != NULL) return item;
+        atomic_fetch_add(&steal->sleepers, 1);
+        futex_wait(&steal->event, watched);
+        atomic_fetch_sub(&steal->sleepers, 1);
+    }
+}
+
+//only push to the first active queues, the consumers of the others are retiring and drain what they hold
+void steal_queues_set_active(StealQueues *steal, int active) {
+    atomic_store(&steal->active, active > 0 && active <= steal->count ? active : steal->count);
+}
+
+//number of items waiting in all queues, a snapshot
+size_t steal_queues_depth(StealQueues *steal) {
+    size_t depth = 0;
+    for (int i = 0; i < steal->count; i++) depth += sched_queue_depth(&steal->queues[i]);
+    return depth;
+}
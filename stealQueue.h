@@ -0,0 +1,36 @@
+#ifndef STEAL_QUEUE_H
+#define STEAL_QUEUE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "schedQueue.h"
+
+//what one consumer took, written only by that consumer
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t local; //items taken from its own queue
+    _Atomic uint64_t stolen; //items taken from another consumer's queue
+    _Atomic uint64_t failed_steals; //queues found empty while looking for work
+    uint32_t random; //xorshift state for picking victims
+} StealCounters;
+
+//one queue per consumer: producers spread items over them, a consumer drains its own queue and steals
+//from a random victim when it runs empty. Idle consumers sleep on one shared futex word.
+typedef struct {
+    SchedQueue *queues;
+    StealCounters *counters;
+    int count;
+    int next; //queue of the next push, producers are serialized by the caller
+    atomic_int active; //pushes go to the first active queues, the others are only drained
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t event; //futex word bumped on every push
+    _Atomic uint32_t sleepers; //consumers sleeping on event
+} StealQueues;
+
+int steal_queues_init(StealQueues *steal, int count, SchedPolicy policy, size_t capacity);
+int steal_queues_push(StealQueues *steal, void *item, uint64_t key);
+void *steal_queues_pop(StealQueues *steal, int self);
+void *steal_queues_pop_wait(StealQueues *steal, int self);
+size_t steal_queues_depth(StealQueues *steal);
+void steal_queues_set_active(StealQueues *steal, int active);
+
+#endif
@@ -0,0 +1,132 @@
+#include "timerWheel.h"
+
+//timers are placed by how far away they are: level L holds timers less than WHEEL_SIZE^(L+1) ticks ahead.
+//whenever a lower level wraps around, the matching slot of the level above is spread back down.
+
+#define LEVEL_SLOT(tick, level) (((tick) >> ((level) * WHEEL_BITS)) & (WHEEL_SIZE - 1))
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t start_ns, uint64_t tick_ns) {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SIZE; slot++) wheel->slots[level][slot] = NULL;
+    }
+    for (int level = 0; level <= WHEEL_LEVELS; level++) wheel->level_count[level] = 0;
+    wheel->overflow = NULL;
+    wheel->expired = NULL;
+    wheel->start_ns = start_ns;
+    wheel->tick_ns = tick_ns > 0 ? tick_ns : 1;
+    wheel->current_tick = 0;
+    wheel->count = 0;
+}
+
+//put a timer into the slot that matches its distance from the current tick
+static void place(TimerWheel *wheel, TimerEntry *timer) {
+    TimerEntry **list;
+    uint64_t tick = timer->expires_tick;
+    if (tick <= wheel->current_tick) {
+        list = &wheel->expired;
+    } else {
+        uint64_t distance = tick - wheel->current_tick;
+        int level = 0;
+        while (level < WHEEL_LEVELS && distance >= (1ull << ((level + 1) * WHEEL_BITS))) level++;
+        list = level < WHEEL_LEVELS ? &wheel->slots[level][LEVEL_SLOT(tick, level)] : &wheel->overflow;
+        wheel->level_count[level]++;
+    }
+    timer->next = *list;
+    *list = timer;
+}
+
+//schedule a timer, expiry is rounded up to the next tick
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *timer, uint64_t expires_ns) {
+    uint64_t offset = expires_ns > wheel->start_ns ? expires_ns - wheel->start_ns : 0;
+    timer->expires_tick = (offset + wheel->tick_ns - 1) / wheel->tick_ns;
+    place(wheel, timer);
+    wheel->count++;
+}
+
+//detach the list of a slot, level WHEEL_LEVELS is the overflow list
+static TimerEntry *take_list(TimerWheel *wheel, int level, int slot) {
+    TimerEntry **list = level < WHEEL_LEVELS ? &wheel->slots[level][slot] : &wheel->overflow;
+    TimerEntry *taken = *list;
+    *list = NULL;
+    for (TimerEntry *timer = taken; timer != NULL; timer = timer->next) wheel->level_count[level]--;
+    return taken;
+}
+
+//spread the current slot of a level over the levels below it
+static void cascade(TimerWheel *wheel, int level) {
+    int slot = 0;
+    if (level < WHEEL_LEVELS) {
+        slot = LEVEL_SLOT(wheel->current_tick, level);
+        if (slot == 0) cascade(wheel, level + 1); //the level above wraps at the same tick
+    }
+    TimerEntry *list = take_list(wheel, level, slot);
+    while (list != NULL) {
+        TimerEntry *next = list->next;
+        place(wheel, list);
+        list = next;
+    }
+}
+
+//lowest level holding timers, WHEEL_LEVELS for the overflow list
+static int lowest_level(TimerWheel *wheel) {
+    int level = 0;
+    while (level < WHEEL_LEVELS && wheel->level_count[level] == 0) level++;
+    return level;
+}
+
+//move time forward to now_ns and return the list of timers that fired
+TimerEntry *timer_wheel_advance(TimerWheel *wheel, uint64_t now_ns) {
+    TimerEntry *fired = wheel->expired;
+    wheel->expired = NULL;
+    uint64_t target = now_ns > wheel->start_ns ? (now_ns - wheel->start_ns) / wheel->tick_ns : 0;
+
+    while (wheel->current_tick < target && wheel->count > 0) {
+        //nothing below level L can fire before level L-1 wraps, so skip straight to that tick
+        int level = lowest_level(wheel);
+        if (level > 0) {
+            uint64_t span = 1ull << (level * WHEEL_BITS);
+            uint64_t wrap = (wheel->current_tick | (span - 1)) + 1;
+            if (wrap > target) break;
+            wheel->current_tick = wrap - 1;
+        }
+
+        wheel->current_tick++;
+        int slot = LEVEL_SLOT(wheel->current_tick, 0);
+        if (slot == 0) cascade(wheel, 1);
+        TimerEntry *list = take_list(wheel, 0, slot);
+        //cascading can drop timers that are due now into the expired list
+        while (wheel->expired != NULL) {
+            TimerEntry *timer = wheel->expired;
+            wheel->expired = timer->next;
+            timer->next = list;
+            list = timer;
+        }
+        while (list != NULL) {
+            TimerEntry *next = list->next;
+            list->next = fired;
+            fired = list;
+            list = next;
+        }
+    }
+    if (wheel->current_tick < target) wheel->current_tick = target;
+
+    for (TimerEntry *timer = fired; timer != NULL; timer = timer->next) wheel->count--;
+    return fired;
+}
+
+//earliest time a timer may fire, never later than the real expiry; UINT64_MAX if the wheel is empty
+uint64_t timer_wheel_next_expiry(TimerWheel *wheel) {
+    if (wheel->count == 0) return UINT64_MAX;
+    if (wheel->expired != NULL) return wheel->start_ns + wheel->current_tick * wheel->tick_ns;
+
+    int level = lowest_level(wheel);
+    if (level == 0) {
+        for (uint64_t tick = wheel->current_tick + 1; tick <= wheel->current_tick + WHEEL_SIZE; tick++) {
+            if (wheel->slots[0][LEVEL_SLOT(tick, 0)] != NULL) return wheel->start_ns + tick * wheel->tick_ns;
+        }
+    }
+    //timers in higher levels cannot fire before the level below them wraps around
+    uint64_t span = 1ull << (level * WHEEL_BITS);
+    uint64_t wrap = (wheel->current_tick | (span - 1)) + 1;
+    return wheel->start_ns + wrap * wheel->tick_ns;
+}
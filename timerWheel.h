@@ -0,0 +1,36 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS) //slots per level
+#define WHEEL_LEVELS 4 //covers WHEEL_SIZE^4 ticks, later timers wait in an overflow list
+#define DEFAULT_WHEEL_TICK_US 10 //resolution of the courier timer wheel
+
+//timer embedded in the object it belongs to
+typedef struct TimerEntry {
+    uint64_t expires_tick; //tick at which the timer fires
+    void *owner; //object the timer belongs to
+    struct TimerEntry *next;
+} TimerEntry;
+
+//hierarchical timing wheel, owned by a single thread
+typedef struct {
+    TimerEntry *slots[WHEEL_LEVELS][WHEEL_SIZE];
+    TimerEntry *overflow; //timers beyond the range of the top level
+    TimerEntry *expired; //timers added with a time that already passed
+    uint64_t start_ns; //time of tick 0
+    uint64_t tick_ns; //length of a tick
+    uint64_t current_tick; //last tick that was processed
+    size_t count; //timers in the wheel
+    size_t level_count[WHEEL_LEVELS + 1]; //timers per level, the last entry counts the overflow list
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t start_ns, uint64_t tick_ns);
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *timer, uint64_t expires_ns);
+TimerEntry *timer_wheel_advance(TimerWheel *wheel, uint64_t now_ns);
+uint64_t timer_wheel_next_expiry(TimerWheel *wheel);
+
+#endif